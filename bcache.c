@@ -0,0 +1,417 @@
+/*
+ * Author(s): Changxiao Xie
+ * COS 318, Fall 2018: Project 6 File System.
+ * Write-back block buffer cache that sits between the file system and the disk.
+*/
+#include "util.h"
+#include "common.h"
+#include "block.h"
+#include "bcache.h"
+
+typedef struct buffer {
+    int block; // block number cached in this buffer, -1 if unused
+    bool_t dirty; // TRUE if data differs from the copy on disk
+    bool_t prefetched; // TRUE if read ahead and not looked up since
+    bool_t uncommitted; // TRUE if metadata changed by the running transaction, it must reach the log before its home
+    struct buffer *hash_next; // next buffer in the same hash bucket
+    struct buffer *lru_prev; // more recently used neighbour
+    struct buffer *lru_next; // less recently used neighbour
+    char data[BLOCK_SIZE];
+} buffer_t;
+
+static buffer_t buffers[BCACHE_SIZE];
+static buffer_t *hash_table[BCACHE_HASH_SIZE];
+static buffer_t *lru_head; // most recently used buffer
+static buffer_t *lru_tail; // least recently used buffer, first to be evicted
+static bcache_stats_t stats;
+static char run_buffer[BCACHE_MAX_RUN * BLOCK_SIZE]; // staging area for read ahead runs
+static char flush_buffer[BCACHE_MAX_RUN * BLOCK_SIZE]; // staging area for write back runs, a flush can happen in the middle of a read ahead
+static bool_t journaled; // TRUE if metadata writes belong to the running transaction of the log
+static int num_uncommitted; // buffers with uncommitted set
+
+#define HASH(block) ((block) & (BCACHE_HASH_SIZE - 1))
+
+// LRU LIST STUFF
+
+// unlink a buffer from the LRU list
+static void lru_remove(buffer_t *buf) {
+    if (buf->lru_prev != NULL)
+        buf->lru_prev->lru_next = buf->lru_next;
+    else
+        lru_head = buf->lru_next;
+    if (buf->lru_next != NULL)
+        buf->lru_next->lru_prev = buf->lru_prev;
+    else
+        lru_tail = buf->lru_prev;
+}
+
+// put a buffer at the most recently used end of the LRU list
+static void lru_push_front(buffer_t *buf) {
+    buf->lru_prev = NULL;
+    buf->lru_next = lru_head;
+    if (lru_head != NULL)
+        lru_head->lru_prev = buf;
+    lru_head = buf;
+    if (lru_tail == NULL)
+        lru_tail = buf;
+}
+
+// HASH INDEX STUFF
+
+// find the buffer holding block, otherwise return NULL
+static buffer_t *hash_find(int block) {
+    buffer_t *buf;
+    for (buf = hash_table[HASH(block)]; buf != NULL; buf = buf->hash_next) {
+        if (buf->block == block)
+            return buf;
+    }
+    return NULL;
+}
+
+static void hash_insert(buffer_t *buf) {
+    buf->hash_next = hash_table[HASH(buf->block)];
+    hash_table[HASH(buf->block)] = buf;
+}
+
+static void hash_remove(buffer_t *buf) {
+    buffer_t **link;
+    for (link = &hash_table[HASH(buf->block)]; *link != NULL; link = &(*link)->hash_next) {
+        if (*link == buf) {
+            *link = buf->hash_next;
+            return;
+        }
+    }
+}
+
+// BUFFER STUFF
+
+// write a dirty buffer back to its home location on disk
+static void buffer_write_back(buffer_t *buf) {
+    if (buf->block != -1 && buf->dirty) {
+        block_write(buf->block, buf->data);
+        stats.disk_writes++;
+        buf->dirty = FALSE;
+    }
+}
+
+// take the least recently used buffer that may go home, write it back if needed, and rebind it to block
+static buffer_t *buffer_evict(int block) {
+    buffer_t *buf;
+
+    for (buf = lru_tail; buf != NULL && buf->uncommitted; buf = buf->lru_prev);
+    // the file system commits at operation boundaries early enough that this cannot happen,
+    // committing here would log half of an operation
+    ASSERT(buf != NULL);
+
+    buffer_write_back(buf);
+    if (buf->prefetched) {
+        stats.ra_wasted++;
+        buf->prefetched = FALSE;
+    }
+    if (buf->block != -1)
+        hash_remove(buf);
+    buf->block = block;
+    hash_insert(buf);
+    return buf;
+}
+
+// look up block in the cache, counting the hit or miss
+static buffer_t *buffer_lookup(int block) {
+    buffer_t *buf = hash_find(block);
+    if (buf != NULL) {
+        stats.hits++;
+        if (buf->prefetched) {
+            stats.ra_hits++;
+            buf->prefetched = FALSE;
+        }
+    }
+    else
+        stats.misses++;
+    return buf;
+}
+
+// CACHE INTERFACE
+
+// set up an empty cache with every buffer on the LRU list
+void bcache_init(void) {
+    int i;
+
+    bzero((char *)hash_table, sizeof(hash_table));
+    bzero((char *)&stats, sizeof(stats));
+    lru_head = NULL;
+    lru_tail = NULL;
+    for (i = 0; i < BCACHE_SIZE; i++) {
+        buffers[i].block = -1;
+        buffers[i].dirty = FALSE;
+        buffers[i].prefetched = FALSE;
+        buffers[i].uncommitted = FALSE;
+        buffers[i].hash_next = NULL;
+        lru_push_front(&buffers[i]);
+    }
+    journaled = FALSE;
+    num_uncommitted = 0;
+}
+
+// copy block into mem, reading it from disk only on a miss
+void bcache_read(int block, char *mem) {
+    buffer_t *buf = buffer_lookup(block);
+
+    if (buf == NULL) {
+        buf = buffer_evict(block);
+        block_read(block, buf->data);
+        stats.disk_reads++;
+    }
+    lru_remove(buf);
+    lru_push_front(buf);
+    bcopy((unsigned char *)buf->data, (unsigned char *)mem, BLOCK_SIZE);
+}
+
+// copy mem into the cached block and mark it dirty, return the buffer
+static buffer_t *buffer_write(int block, char *mem) {
+    buffer_t *buf = buffer_lookup(block);
+
+    // a whole block is overwritten, so a miss does not need to read the old contents
+    if (buf == NULL)
+        buf = buffer_evict(block);
+    lru_remove(buf);
+    lru_push_front(buf);
+    bcopy((unsigned char *)mem, (unsigned char *)buf->data, BLOCK_SIZE);
+    buf->dirty = TRUE;
+    return buf;
+}
+
+// write a metadata block; the disk is updated on eviction or flush, and when metadata is
+// journaled only after the running transaction has been committed to the log
+void bcache_write(int block, char *mem) {
+    buffer_t *buf = buffer_write(block, mem);
+
+    if (journaled && !buf->uncommitted) {
+        buf->uncommitted = TRUE;
+        num_uncommitted++;
+    }
+}
+
+// write a file data block, which is never journaled and may go home at any time
+void bcache_write_data(int block, char *mem) {
+    buffer_t *buf = buffer_write(block, mem);
+
+    if (buf->uncommitted) {
+        buf->uncommitted = FALSE;
+        num_uncommitted--;
+    }
+}
+
+// drop the cached copy of block, if any, without writing it back
+static void buffer_discard(int block) {
+    buffer_t *buf = hash_find(block);
+
+    if (buf == NULL)
+        return;
+    hash_remove(buf);
+    if (buf->uncommitted)
+        num_uncommitted--;
+    buf->block = -1;
+    buf->dirty = FALSE;
+    buf->prefetched = FALSE;
+    buf->uncommitted = FALSE;
+    lru_remove(buf);
+    // an empty buffer is the first one to reuse
+    buf->lru_next = NULL;
+    buf->lru_prev = lru_tail;
+    if (lru_tail != NULL)
+        lru_tail->lru_next = buf;
+    lru_tail = buf;
+    if (lru_head == NULL)
+        lru_head = buf;
+}
+
+// block was freed and what it holds is dead: drop the cached copy, if any, without writing it back
+void bcache_discard(int block) {
+    buffer_discard(block);
+}
+
+// copy count consecutive blocks into mem, reading each run of missing blocks with one transfer.
+// a long transfer reads the missing blocks straight into mem and leaves them out of the cache,
+// so a large sequential copy neither copies every block twice nor flushes out everything else
+void bcache_read_multi(int block, int count, char *mem) {
+    buffer_t *buf;
+    int i, j, n;
+    bool_t direct = (count >= BCACHE_DIRECT_RUN);
+
+    i = 0;
+    while (i < count) {
+        buf = buffer_lookup(block + i);
+        if (buf != NULL) {
+            lru_remove(buf);
+            lru_push_front(buf);
+            bcopy((unsigned char *)buf->data, (unsigned char *)&mem[i * BLOCK_SIZE], BLOCK_SIZE);
+            i++;
+            continue;
+        }
+
+        // gather the misses that follow and read them straight into mem
+        for (n = 1; i + n < count && hash_find(block + i + n) == NULL; n++) {
+            stats.misses++;
+        }
+        block_read_multi(block + i, n, &mem[i * BLOCK_SIZE]);
+        stats.disk_reads++;
+
+        // then keep a copy of each in the cache
+        for (j = i; j < i + n && !direct; j++) {
+            buf = buffer_evict(block + j);
+            lru_remove(buf);
+            lru_push_front(buf);
+            bcopy((unsigned char *)&mem[j * BLOCK_SIZE], (unsigned char *)buf->data, BLOCK_SIZE);
+        }
+        i += n;
+    }
+}
+
+// copy count consecutive file data blocks from mem into the cache. a long transfer overwrites whole
+// blocks, so it goes straight to the disk in one transfer and any stale cached copies are dropped
+void bcache_write_multi(int block, int count, char *mem) {
+    int i;
+
+    if (count < BCACHE_DIRECT_RUN) {
+        for (i = 0; i < count; i++) {
+            bcache_write_data(block + i, &mem[i * BLOCK_SIZE]);
+        }
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        buffer_discard(block + i);
+    }
+    block_write_multi(block, count, mem);
+    stats.disk_writes++;
+}
+
+// bring count consecutive blocks into the cache ahead of use, reading each run of missing
+// blocks with one transfer. blocks already cached are left alone and nothing is counted as
+// a lookup, so the hit rate only reflects what the file system actually asked for
+void bcache_prefetch(int block, int count) {
+    buffer_t *buf;
+    int i, j, n;
+
+    i = 0;
+    while (i < count) {
+        if (hash_find(block + i) != NULL) {
+            i++;
+            continue;
+        }
+
+        for (n = 1; i + n < count && n < BCACHE_MAX_RUN && hash_find(block + i + n) == NULL; n++);
+        block_read_multi(block + i, n, run_buffer);
+        stats.disk_reads++;
+
+        for (j = 0; j < n; j++) {
+            buf = buffer_evict(block + i + j);
+            lru_remove(buf);
+            lru_push_front(buf);
+            bcopy((unsigned char *)&run_buffer[j * BLOCK_SIZE], (unsigned char *)buf->data, BLOCK_SIZE);
+            buf->prefetched = TRUE;
+        }
+        i += n;
+    }
+}
+
+// write the dirty buffers of blocks first to last - 1 back to disk, except metadata the log does
+// not hold yet. the buffers go out in block order and each run of consecutive blocks takes one transfer
+static void buffers_flush(int first, int last) {
+    buffer_t *sorted[BCACHE_SIZE];
+    buffer_t *buf;
+    int count;
+    int i, j, n;
+
+    // the cache is small, an insertion sort of the dirty buffers is enough
+    count = 0;
+    for (i = 0; i < BCACHE_SIZE; i++) {
+        buf = &buffers[i];
+        if (buf->block < first || buf->block >= last || !buf->dirty || buf->uncommitted) { continue; }
+        for (j = count; j > 0 && sorted[j - 1]->block > buf->block; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = buf;
+        count++;
+    }
+
+    for (i = 0; i < count; i += n) {
+        for (n = 1; i + n < count && n < BCACHE_MAX_RUN && sorted[i + n]->block == sorted[i]->block + n; n++);
+        if (n == 1) {
+            buffer_write_back(sorted[i]);
+            continue;
+        }
+        for (j = 0; j < n; j++) {
+            bcopy((unsigned char *)sorted[i + j]->data, (unsigned char *)&flush_buffer[j * BLOCK_SIZE], BLOCK_SIZE);
+            sorted[i + j]->dirty = FALSE;
+        }
+        block_write_multi(sorted[i]->block, n, flush_buffer);
+        stats.disk_writes++;
+    }
+}
+
+// write every dirty buffer back to disk
+void bcache_flush(void) {
+    buffers_flush(0, 0x7fffffff);
+}
+
+// write the dirty buffers of count blocks starting at block back to disk
+void bcache_flush_range(int block, int count) {
+    buffers_flush(block, block + count);
+}
+
+// drop every cached block without writing it back, used when the disk is reformatted
+void bcache_invalidate(void) {
+    int i;
+    for (i = 0; i < BCACHE_SIZE; i++) {
+        if (buffers[i].block != -1)
+            hash_remove(&buffers[i]);
+        buffers[i].block = -1;
+        buffers[i].dirty = FALSE;
+        buffers[i].prefetched = FALSE;
+        buffers[i].uncommitted = FALSE;
+    }
+    num_uncommitted = 0;
+}
+
+// JOURNAL INTERFACE
+
+// journal metadata writes from now on, or stop if on is FALSE. the caller has to commit before
+// the uncommitted blocks take up the whole cache
+void bcache_set_journal(bool_t on) {
+    journaled = on;
+}
+
+int bcache_num_uncommitted(void) {
+    return num_uncommitted;
+}
+
+// list up to max blocks changed by the running transaction, return how many were listed
+int bcache_uncommitted(int *blocks, int max) {
+    int i, n = 0;
+    for (i = 0; i < BCACHE_SIZE && n < max; i++) {
+        if (buffers[i].uncommitted)
+            blocks[n++] = buffers[i].block;
+    }
+    return n;
+}
+
+// copy a cached block into mem without counting a lookup or changing its LRU position
+void bcache_peek(int block, char *mem) {
+    buffer_t *buf = hash_find(block);
+    ASSERT(buf != NULL);
+    bcopy((unsigned char *)buf->data, (unsigned char *)mem, BLOCK_SIZE);
+}
+
+// the running transaction is in the log, its blocks may now be written home
+void bcache_committed(void) {
+    int i;
+    for (i = 0; i < BCACHE_SIZE; i++) {
+        buffers[i].uncommitted = FALSE;
+    }
+    num_uncommitted = 0;
+}
+
+void bcache_get_stats(bcache_stats_t *stats_buf) {
+    bcopy((unsigned char *)&stats, (unsigned char *)stats_buf, sizeof(stats));
+}
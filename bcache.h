@@ -0,0 +1,43 @@
+/*
+ * Author(s): Changxiao Xie
+ * COS 318, Fall 2018: Project 6 File System.
+ * Write-back block buffer cache that sits between the file system and the disk.
+*/
+#ifndef BCACHE_INCLUDED
+#define BCACHE_INCLUDED
+
+#define BCACHE_SIZE 64 // number of blocks the cache can hold
+#define BCACHE_HASH_SIZE 64 // number of hash buckets, must be a power of 2
+#define BCACHE_MAX_RUN 8 // most blocks a prefetch reads or a flush writes with one transfer
+#define BCACHE_DIRECT_RUN 8 // multi-block transfers at least this long bypass the cache
+
+typedef struct {
+    uint32_t hits; // lookups served from the cache
+    uint32_t misses; // lookups that had to go to the disk
+    uint32_t disk_reads; // physical block_read calls made by the cache
+    uint32_t disk_writes; // physical block_write calls made by the cache
+    uint32_t ra_hits; // prefetched blocks that were later looked up
+    uint32_t ra_wasted; // prefetched blocks evicted before anyone looked them up
+} bcache_stats_t;
+
+void bcache_init(void);
+void bcache_read(int block, char *mem);
+void bcache_write(int block, char *mem);
+void bcache_write_data(int block, char *mem);
+void bcache_read_multi(int block, int count, char *mem);
+void bcache_write_multi(int block, int count, char *mem);
+void bcache_prefetch(int block, int count);
+void bcache_discard(int block);
+void bcache_flush(void);
+void bcache_flush_range(int block, int count);
+void bcache_invalidate(void);
+void bcache_get_stats(bcache_stats_t *stats);
+
+// hooks for the metadata journal
+void bcache_set_journal(bool_t on);
+int bcache_num_uncommitted(void);
+int bcache_uncommitted(int *blocks, int max);
+void bcache_peek(int block, char *mem);
+void bcache_committed(void);
+
+#endif
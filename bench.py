@@ -0,0 +1,244 @@
+#!/usr/bin/python
+
+# Benchmarks for the file system. Each benchmark drives lnxsh against
+# ./disk and reports the wall clock time along with the buffer cache
+# counters printed by the fsinfo command.
+
+import os, sys, subprocess, time, tempfile, shutil
+
+def spawn_lnxsh(cwd=None):
+    global p
+    p = subprocess.Popen(os.path.abspath('./lnxsh'), shell=True, cwd=cwd,
+                         stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+
+def issue(command):
+    p.stdin.write(command + '\n')
+
+def do_exit():
+    issue('exit')
+    return p.communicate()[0]
+
+# Pull the counters of the last fsinfo command out of the shell output
+def fsinfo(output):
+    info = {}
+    for line in output.split('\n'):
+        if ':' in line:
+            name, value = line.split(':', 1)
+            name = name.strip(' #')
+            if name in ('Cache hits', 'Cache misses', 'Disk reads', 'Disk writes',
+                        'Name cache hits', 'Name cache misses', 'Readahead hits',
+                        'Readahead wasted', 'Log commits', 'Log blocks'):
+                info[name] = int(value)
+    return info
+
+def report(name, seconds, output):
+    info = fsinfo(output)
+    print '%-28s %8.3f s   hits %8d   misses %6d   reads %6d   writes %6d   names %6d/%d   ra %5d/%d   log %5d/%d' % (name,
+        seconds, info.get('Cache hits', 0), info.get('Cache misses', 0),
+        info.get('Disk reads', 0), info.get('Disk writes', 0),
+        info.get('Name cache hits', 0), info.get('Name cache misses', 0),
+        info.get('Readahead hits', 0), info.get('Readahead wasted', 0),
+        info.get('Log commits', 0), info.get('Log blocks', 0))
+    sys.stdout.flush()
+
+# Fill the inode table: every create has to find a free inode, so the
+# cost of the inode allocator grows with how full the file system is.
+def create_bench(num_files):
+    spawn_lnxsh()
+    issue('mkfs')
+    start = time.time()
+    for i in range(0, num_files):
+        if i % 100 == 0:
+            if i > 0:
+                issue('cd ..')
+            issue('mkdir d' + str(i / 100))
+            issue('cd d' + str(i / 100))
+        issue('create f' + str(i) + ' 0')
+    issue('fsinfo')
+    output = do_exit()
+    report('create %d files' % num_files, time.time() - start, output)
+
+# Write a file deep into the double indirect blocks and read it back
+# sequentially: the per descriptor mapping window should keep the
+# indirect block lookups from showing up as extra cache traffic.
+def large_file_bench(size):
+    spawn_lnxsh()
+    issue('mkfs')
+    start = time.time()
+    issue('create f ' + str(size))
+    issue('open f 1')
+    for i in range(0, size / 512 + 1):
+        issue('read 0 512')
+    issue('close 0')
+    issue('fsinfo')
+    output = do_exit()
+    report('large file %d bytes' % size, time.time() - start, output)
+
+# Read a file back in small pieces after a restart, the way cat does:
+# readahead should turn the cold misses into a few batched transfers.
+def small_read_bench(size):
+    spawn_lnxsh()
+    issue('mkfs')
+    issue('create f ' + str(size))
+    do_exit()
+    spawn_lnxsh()
+    start = time.time()
+    issue('open f 1')
+    for i in range(0, size / 40 + 1):
+        issue('read 0 40')
+    issue('close 0')
+    issue('fsinfo')
+    output = do_exit()
+    report('small reads %d bytes' % size, time.time() - start, output)
+
+# Copy a large file after a restart: every transfer covers whole
+# blocks, so the data should move between the disk and the shell's
+# buffer without going through the cache.
+def copy_bench(size):
+    spawn_lnxsh()
+    issue('mkfs')
+    issue('create f ' + str(size))
+    do_exit()
+    spawn_lnxsh()
+    start = time.time()
+    issue('cp f g')
+    issue('fsinfo')
+    output = do_exit()
+    report('copy %d bytes' % size, time.time() - start, output)
+
+# Clone the same file after a restart: only the block mapping and the
+# reference counts are written, the data blocks are not touched
+def clone_bench(size):
+    spawn_lnxsh()
+    issue('mkfs')
+    issue('create f ' + str(size))
+    do_exit()
+    spawn_lnxsh()
+    start = time.time()
+    issue('clone f g')
+    issue('fsinfo')
+    output = do_exit()
+    report('clone %d bytes' % size, time.time() - start, output)
+
+# Grow files in several directories side by side, then read them back
+# after a restart: files kept in few runs of blocks read in few transfers
+def frag_bench(rounds):
+    spawn_lnxsh()
+    issue('mkfs')
+    for d in range(0, 4):
+        issue('mkdir d' + str(d))
+        for i in range(0, 4):
+            issue('create d' + str(d) + '/f' + str(i) + ' 100')
+    for d in range(0, 4):
+        for i in range(0, 4):
+            issue('open d' + str(d) + '/f' + str(i) + ' 3')
+    for r in range(0, rounds):
+        for fd in range(0, 16):
+            issue('lseek ' + str(fd) + ' ' + str(100 + r * 40))
+            issue('write ' + str(fd) + ' ' + 'x' * 40)
+    for fd in range(0, 16):
+        issue('close ' + str(fd))
+    do_exit()
+    spawn_lnxsh()
+    start = time.time()
+    for d in range(0, 4):
+        for i in range(0, 4):
+            issue('cp d' + str(d) + '/f' + str(i) + ' g')
+            issue('unlink g')
+    issue('fsinfo')
+    output = do_exit()
+    report('fragmented read %d rounds' % rounds, time.time() - start, output)
+
+# Unlink files of size bytes after a restart: freeing a block only
+# clears its bit, so the cost should not grow with the size of the files
+def unlink_bench(num_files, size):
+    spawn_lnxsh()
+    issue('mkfs')
+    for i in range(0, num_files):
+        issue('create f' + str(i) + ' ' + str(size))
+    do_exit()
+    spawn_lnxsh()
+    start = time.time()
+    for i in range(0, num_files):
+        issue('unlink f' + str(i))
+    issue('sync')
+    issue('fsinfo')
+    output = do_exit()
+    report('unlink %d files of %d bytes' % (num_files, size), time.time() - start, output)
+
+# Create num_files files in a single directory and stat every one of
+# them, so the cost is dominated by name lookups in a large directory.
+def lookup_bench(num_files):
+    spawn_lnxsh()
+    issue('mkfs')
+    issue('mkdir d')
+    issue('cd d')
+    start = time.time()
+    for i in range(0, num_files):
+        issue('create f' + str(i) + ' 0')
+    for i in range(0, num_files):
+        issue('stat f' + str(i))
+    issue('fsinfo')
+    output = do_exit()
+    report('lookup %d files' % num_files, time.time() - start, output)
+
+# Stat the same few names over and over, including one that does not
+# exist; after the first round no directory block should be read.
+def repeat_lookup_bench(rounds):
+    spawn_lnxsh()
+    issue('mkfs')
+    issue('mkdir d')
+    issue('cd d')
+    for i in range(0, 50):
+        issue('create f' + str(i) + ' 0')
+    start = time.time()
+    for r in range(0, rounds):
+        for i in range(0, 20):
+            issue('stat f' + str(i))
+        issue('stat missing')
+    issue('fsinfo')
+    output = do_exit()
+    report('repeat lookup %d rounds' % rounds, time.time() - start, output)
+
+# Rebuild lnxsh with extra compiler flags, e.g. a different BLOCK_SIZE_BITS
+def build_lnxsh(flags):
+    devnull = open(os.devnull, 'w')
+    subprocess.check_call('rm -f *Fake.o lnxsh && make lnxsh CFLAGS="-fno-builtin-strlen '
+                          '-fno-builtin-bcopy -fno-builtin-bzero ' + flags + '"',
+                          shell=True, stdout=devnull, stderr=devnull)
+
+# Format a new disk of fs_size blocks in a scratch directory. The first
+# boot formats the empty disk at the default size and the mkfs command
+# formats it again at fs_size, so both paths are timed. With zero_data
+# mkfs also zeroes every data block.
+def mkfs_bench(fs_size, zero_data):
+    build_lnxsh('-DFS_MAX_SIZE=65536 -DMKFS_ZERO_DATA=%d' % zero_data)
+    scratch = tempfile.mkdtemp()
+    start = time.time()
+    spawn_lnxsh(scratch)
+    issue('mkfs %d' % fs_size)
+    issue('fsinfo')
+    output = do_exit()
+    report('mkfs %6d blocks %s' % (fs_size, zero_data and 'full ' or 'quick'), time.time() - start, output)
+    shutil.rmtree(scratch)
+
+create_bench(500)
+create_bench(1400)
+large_file_bench(600000)
+small_read_bench(100000)
+copy_bench(600000)
+clone_bench(600000)
+frag_bench(300)
+unlink_bench(50, 512)
+unlink_bench(50, 8192)
+lookup_bench(1000)
+repeat_lookup_bench(200)
+for fs_size in (2048, 16384, 65536):
+    mkfs_bench(fs_size, 1)
+    mkfs_bench(fs_size, 0)
+# Copy the same file on file systems built with larger blocks
+for bits in (10, 12):
+    build_lnxsh('-DBLOCK_SIZE_BITS=%d' % bits)
+    print '%d byte blocks:' % (1 << bits)
+    copy_bench(600000)
+build_lnxsh('')
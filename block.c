@@ -2,27 +2,52 @@
 #include "kernel.h"
 #include "util.h"
 #include "block.h"
+#include "fs.h"
 #include "usb.h"
 
 #define START_SECTOR (MAX_IMAGE_SIZE/SECTOR_SIZE)
 
 void block_init( void) {
-    ASSERT( BLOCK_SIZE == SECTOR_SIZE );
+    ASSERT( BLOCK_SIZE % SECTOR_SIZE == 0 );
 }
 
+/* Block numbers are bounded by the largest file system mkfs lays out, the
+ * device itself is whatever the image or the USB stick provides. */
 void block_read( int block, char *mem) {
-    if (block < 0 || block > 1024 * 2) {
+    int i;
+
+    if (block < 0 || block >= FS_MAX_SIZE) {
 	dprint("BUG READ?");
 	print_int(0,0, block);
     }
-    read(START_SECTOR+block, mem);
+    for ( i = 0; i < BLOCK_SECTORS; i++)
+	read(START_SECTOR + block * BLOCK_SECTORS + i, mem + i * SECTOR_SIZE);
 }
 
 void block_write( int block, char *mem) {
-    if (block < 0 || block > 1024 * 2) {
+    int i;
+
+    if (block < 0 || block >= FS_MAX_SIZE) {
 	dprint("BUG WRITE?");
     }
-    write(START_SECTOR+block, mem);
+    for ( i = 0; i < BLOCK_SECTORS; i++)
+	write(START_SECTOR + block * BLOCK_SECTORS + i, mem + i * SECTOR_SIZE);
+}
+
+/* The BIOS call behind read() and write() moves one sector through the
+ * V86 buffer, so a run of blocks is still transferred a sector at a time. */
+void block_read_multi( int block, int count, char *mem) {
+    int i;
+
+    for ( i = 0; i < count; i++)
+	block_read( block + i, mem + i * BLOCK_SIZE);
+}
+
+void block_write_multi( int block, int count, char *mem) {
+    int i;
+
+    for ( i = 0; i < count; i++)
+	block_write( block + i, mem + i * BLOCK_SIZE);
 }
 
 void bzero_block( char *block) {
@@ -4,13 +4,21 @@
 #define MAX_IMAGE_SIZE 256*1024
 //#define MAX_IMAGE_SIZE 128*1024
 
+// a logical block spans BLOCK_SECTORS sectors; build with -DBLOCK_SIZE_BITS=10, 11 or 12
+// for 1, 2 or 4 KB blocks. mkfs records the size and a file system is only mounted by a
+// build that uses the same one
+#ifndef BLOCK_SIZE_BITS
 #define BLOCK_SIZE_BITS 9
+#endif
 #define BLOCK_SIZE (1 << BLOCK_SIZE_BITS)
 #define BLOCK_MASK (BLOCK_SIZE-1)
+#define BLOCK_SECTORS (BLOCK_SIZE / SECTOR_SIZE)
 
 void bzero_block( char *block);
 void block_init( void);
 void block_read( int block, char *mem);
 void block_write( int block, char *mem);
+void block_read_multi( int block, int count, char *mem);
+void block_write_multi( int block, int count, char *mem);
 
 #endif
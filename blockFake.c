@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 #include "common.h"
 #include "block.h"
 
@@ -24,7 +25,7 @@ void
 block_read( int block, char *mem) {
     int ret;
 
-    ret = fseek( fd, block * BLOCK_SIZE, SEEK_SET);
+    ret = fseek( fd, (long) block * BLOCK_SIZE, SEEK_SET);
     assert( ret == 0);
     
     ret = fread( mem, 1, BLOCK_SIZE, fd);
@@ -39,11 +40,38 @@ void
 block_write( int block, char *mem) {
     int ret;
     
-    ret = fseek( fd, block * BLOCK_SIZE, SEEK_SET);
+    ret = fseek( fd, (long) block * BLOCK_SIZE, SEEK_SET);
     assert( ret == 0);
     
     ret = fwrite( mem, 1, BLOCK_SIZE, fd);
     assert( ret == BLOCK_SIZE);
+    /* A write is on disk once it returns, as with the real device */
+    fflush( fd);
+}
+
+/* Transfer count consecutive blocks with a single seek. */
+void 
+block_read_multi( int block, int count, char *mem) {
+    int ret;
+
+    ret = fseek( fd, (long) block * BLOCK_SIZE, SEEK_SET);
+    assert( ret == 0);
+    
+    ret = fread( mem, 1, count * BLOCK_SIZE, fd);
+    /* Blocks past the end of the file read as zeros */
+    memset( mem + ret, 0, count * BLOCK_SIZE - ret);
+}
+
+void 
+block_write_multi( int block, int count, char *mem) {
+    int ret;
+    
+    ret = fseek( fd, (long) block * BLOCK_SIZE, SEEK_SET);
+    assert( ret == 0);
+    
+    ret = fwrite( mem, 1, count * BLOCK_SIZE, fd);
+    assert( ret == count * BLOCK_SIZE);
+    fflush( fd);
 }
 
 void
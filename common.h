@@ -47,6 +47,15 @@ enum {
 	SYSCALL_READDIR,  /* 25 */
 	SYSCALL_LOADPROC,
 	SYSCALL_WRITE_SERIAL,
+	SYSCALL_FSINFO,
+	SYSCALL_PREAD,
+	SYSCALL_PWRITE,   /* 30 */
+	SYSCALL_READV,
+	SYSCALL_WRITEV,
+	SYSCALL_SYNC,
+	SYSCALL_FSYNC,
+	SYSCALL_GETDENTS,  /* 35 */
+	SYSCALL_CLONE,
 	SYSCALL_COUNT
 };
 
@@ -108,6 +117,8 @@ typedef unsigned long ulong_t;
 #define FS_O_WRONLY 2
 #define FS_O_RDWR 3
 
+#define MKFS_INLINE 1 /* fs_mkfs flag, keep the contents of tiny files and directories in their inodes */
+
 typedef struct {
     // Fill in your stat here, this is just an example
     int inodeNo;        /* the file i-node number */
@@ -115,8 +126,69 @@ typedef struct {
     char links;         /* number of links to the i-node */
     int size;           /* file size in bytes */
     int numBlocks;      /* number of blocks used by the file */
+    int numExtents;     /* number of runs of consecutive blocks the data is stored in */
 } fileStat;
 
+typedef struct {
+    int cacheHits;      /* block lookups served by the buffer cache */
+    int cacheMisses;    /* block lookups the buffer cache had to fetch */
+    int diskReads;      /* physical block reads issued by the buffer cache */
+    int diskWrites;     /* physical block writes issued by the buffer cache */
+    int nameHits;       /* name lookups answered by the name cache */
+    int nameMisses;     /* name lookups that had to search the directory */
+    int raHits;         /* read ahead blocks that were used */
+    int raWasted;       /* read ahead blocks evicted unused */
+    int logCommits;     /* transactions committed to the metadata log */
+    int logBlocks;      /* blocks written to the metadata log */
+    int logCheckpoints; /* times the log was emptied */
+    int blockSize;      /* bytes in a file system block */
+    int numBlocks;      /* blocks in the file system */
+    int freeBlocks;     /* blocks not in use */
+    int numGroups;      /* allocation groups the blocks are split into */
+    int freeInodes;     /* inodes not in use */
+    int sharedBlocks;   /* blocks shared by cloned files */
+} fsInfo;
+
+typedef struct {
+    int inodes;         /* inodes in use */
+    int blocks;         /* blocks in use, the metadata blocks included */
+    int badSuper;       /* 1 if the super block does not match the layout mkfs would pick */
+    int leakedBlocks;   /* blocks marked in use that no inode refers to */
+    int lostBlocks;     /* blocks an inode refers to that were marked free */
+    int badBlocks;      /* block pointers outside the data area or claimed twice */
+    int badRefs;        /* blocks whose reference count did not match the files sharing them */
+    int badGroups;      /* group descriptors whose layout or free counts did not match the maps */
+    int badInodeMap;    /* inodes whose allocation bit was wrong */
+    int orphans;        /* inodes in use that no directory entry names and no descriptor holds */
+    int badLinks;       /* inodes whose link count did not match the entries naming them */
+    int badEntries;     /* directory entries naming a free or out of range inode */
+    int repaired;       /* 1 if the problems found were repaired */
+} fsckInfo;
+
+#define MAX_FILE_NAME 32   /* longest name of a directory entry */
+#define MAX_PATH_NAME 256  /* longest full path, eg: /foo/bar/test.txt, rather than the longest name */
+
+typedef struct {
+    int inodeNo;        /* the i-node number of the entry */
+    short type;         /* the i-node type, DIRECTORY or FILE_TYPE */
+    int size;           /* file size in bytes */
+    int cookie;         /* directory position after this entry, lseek to it to resume there */
+    char name[MAX_FILE_NAME]; /* name of the entry */
+} dirEnt;
+
+#define MAX_FILE_DESCRIPTORS 256 /* descriptors one process can have open */
+
+typedef struct {
+    uint32_t used[MAX_FILE_DESCRIPTORS / 32]; /* bit fd is set while descriptor fd is open */
+    uint32_t gen;       /* file system generation the descriptors were opened in */
+    uint8_t files[MAX_FILE_DESCRIPTORS]; /* open file table entry behind each descriptor */
+} fdTable;
+
+typedef struct {
+    char *base;         /* buffer to transfer to or from */
+    int len;            /* number of bytes in the buffer */
+} ioVec;
+
 /*	Note that this struct only allocates space for the size element.
 
 	To use a message with a body of 50 bytes we must first allocate space for 
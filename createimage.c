@@ -145,10 +145,16 @@ static void create_images(int nfiles, char *files[])
 
     {
 	// tmp workaround to make bochs happy when read/write FS.
+	// room for the file system mkfs lays out by default, same flags as fs.h and block.h
+#ifndef FS_SIZE
 #define FS_SIZE 2048
+#endif
+#ifndef BLOCK_SIZE_BITS
+#define BLOCK_SIZE_BITS 9
+#endif
 #define MAX_IMAGE_SIZE (256*1024)
 	int zero = 0;
-	fseek(image.img, MAX_IMAGE_SIZE + FS_SIZE * SECTOR_SIZE - 4, SEEK_SET);
+	fseek(image.img, MAX_IMAGE_SIZE + ((long) FS_SIZE << BLOCK_SIZE_BITS) - 4, SEEK_SET);
 	fwrite(&zero, sizeof(zero), 1, image.img);
     }
     
@@ -6,422 +6,717 @@
 #include "util.h"
 #include "common.h"
 #include "block.h"
+#include "bcache.h"
 #include "fs.h"
 #include "shellutil.h"
 #include "fs_helpers.h"
+#include "journal.h"
 
 #ifdef FAKE
 #include <stdio.h>
 #define ERROR_MSG(m) printf m;
 #else
+#include "kernel.h"
 #define ERROR_MSG(m)
 #endif
 
 static super_block_t *super_block; // super block of file system
 static char super_block_buffer[BLOCK_SIZE];
 static int working_directory; // inode of current working directory
-static file_t fd_table[MAX_FILE_DESCRIPTORS]; // file descriptor table
+static uint32_t fs_generation; // bumped at every mkfs, descriptors opened before are gone
+#ifdef FAKE
+static fdTable shell_fds; // lnxsh is the only process
+#endif
+
+// the descriptor table of the calling process
+static fdTable *current_fds(void) {
+#ifdef FAKE
+    fdTable *fds = &shell_fds;
+#else
+    fdTable *fds = &current_running->fds;
+#endif
+    if (fds->gen != fs_generation) {
+        bzero((char *)fds->used, sizeof(fds->used));
+        fds->gen = fs_generation;
+    }
+    return fds;
+}
+
+// the open file behind descriptor fd of the calling process, NULL if it is not open
+static file_t *fd_file(int fd) {
+    return fd_lookup(current_fds(), fd);
+}
 
 static int verify_open_fd(int fd) {
-    if (fd >= MAX_FILE_DESCRIPTORS || fd < 0) { return -1; }
-    if (fd_table[fd].open == FALSE) { return -1; }
+    if (fd_file(fd) == NULL) { return -1; }
     return 0;
 }
 
-static int verify_filename(char *fileName) {
-    if (fileName == NULL) { return -1; }
-    if (strlen(fileName) > MAX_FILE_NAME) { return -1; }
-    return 0;
+// return the type of the file with inode inode_num
+static int inode_type(int inode_num) {
+    vnode_t *vnode;
+    int type;
+
+    vnode = vnode_get(inode_num, super_block);
+    type = vnode->inode.type;
+    vnode_put(vnode, super_block);
+    return type;
+}
+
+// copy the next component of *path into name and move *path past it and the slashes after
+// it, so that *path is empty after the last component; return the length of the component
+// or -1 if it is too long
+static int path_next(char **path, char *name) {
+    int length = 0;
+
+    while (**path == '/') { (*path)++; }
+    while (**path != '\0' && **path != '/') {
+        if (length == MAX_FILE_NAME) { return -1; }
+        name[length++] = *(*path)++;
+    }
+    name[length] = '\0';
+    while (**path == '/') { (*path)++; }
+    return length;
+}
+
+// walk every component of path but the last one, starting at the root for an absolute path
+// and at the working directory otherwise. copy the last component into name and return the
+// inode of the directory that holds it, otherwise return -1. each step goes through dir_find,
+// so a walk that was done recently is answered from the name cache
+static int path_parent(char *path, char *name) {
+    int dir;
+
+    if (path == NULL || strlen(path) > MAX_PATH_NAME) { return -1; }
+    dir = (*path == '/') ? ROOT_DIRECTORY : working_directory;
+
+    if (path_next(&path, name) <= 0) { return -1; }
+    while (*path != '\0') {
+        dir = dir_find(dir, name, super_block);
+        if (dir == -1 || inode_type(dir) != TYPE_DIRECTORY) { return -1; }
+        if (path_next(&path, name) == -1) { return -1; }
+    }
+    return dir;
+}
+
+// return the inode path refers to, otherwise return -1
+static int path_lookup(char *path) {
+    char name[MAX_FILE_NAME + 1];
+    int dir;
+
+    // a path made only of slashes is the root
+    if (path != NULL && *path == '/') {
+        dir = 0;
+        while (path[dir] == '/') { dir++; }
+        if (path[dir] == '\0') { return ROOT_DIRECTORY; }
+    }
+
+    dir = path_parent(path, name);
+    if (dir == -1) { return -1; }
+    return dir_find(dir, name, super_block);
+}
+
+// set up a new inode with the features the file system was made with
+static void inode_setup(inode_t *inode, int type) {
+    inode_init(inode, type);
+    if (type == TYPE_FILE && (super_block->features & FS_FEATURE_EXTENTS))
+        inode->flags |= INODE_EXTENT_MAPPED;
+    if (super_block->features & FS_FEATURE_INLINE)
+        inode->flags |= INODE_INLINE;
+}
+
+// write back the metadata an operation changed in memory, batched once per operation. every
+// few operations the changes go to the log together as one transaction
+static void fs_commit(void) {
+    op_end(super_block);
 }
 
 void fs_init( void) {
     block_init();
+    bcache_init();
     super_block = super_block_read(super_block_buffer);
-    if (super_block->magic_num == MAGIC_NUM) {
+    if (super_block->magic_num == MAGIC_NUM && super_block->version == FS_VERSION &&
+        super_block->block_size == BLOCK_SIZE && super_block->fs_size >= FS_MIN_SIZE &&
+        super_block->fs_size <= FS_MAX_SIZE &&
+        (super_block->inode_size == INODE_BASE_SIZE || super_block->inode_size == sizeof(inode_t))) {
+        // finish what the log committed before the last shutdown, then read the result
+        journal_load(super_block->journal_start, super_block->journal_count);
+        bcache_invalidate();
+        super_block = super_block_read(super_block_buffer);
+        alloc_map_load(super_block);
+        vnode_init();
+        dcache_init();
         working_directory = ROOT_DIRECTORY;
-        // initialize file descriptor table
-        bzero((char *)fd_table, sizeof(fd_table));
+        // start with no open files
+        file_table_init();
+        fs_generation++;
     }
     else {
-        fs_mkfs();
+        fs_mkfs(0, 0, 0);
     }
 }
 
-int fs_mkfs( void) {
+// make a file system of num_blocks blocks of block_size bytes, 0 picks FS_SIZE or BLOCK_SIZE.
+// the block size is fixed when the file system code is built, so another one is refused.
+// with MKFS_INLINE in flags the inodes are large enough to keep tiny files and directories
+int fs_mkfs( int num_blocks, int block_size, int flags) {
     int i;
     char zero_block[BLOCK_SIZE];
-    char block_buffer[BLOCK_SIZE];
-    char super_block_buffer[BLOCK_SIZE];
-    inode_t *root_dir;
-
-    // zero all file system blocks
+    vnode_t *root_dir;
+
+    if (num_blocks == 0)
+        num_blocks = FS_SIZE;
+    if (block_size == 0)
+        block_size = BLOCK_SIZE;
+    if (block_size != BLOCK_SIZE) { return -1; }
+    if (num_blocks < FS_MIN_SIZE || num_blocks > FS_MAX_SIZE) { return -1; }
+
+    // drop whatever the caches hold from the old file system
+    vnode_init();
+    dcache_init();
+    bcache_invalidate();
+
+    // lay out the super block, then zero the inode table and the allocation
+    // maps of every group directly on disk; the data blocks are left as they are
+    bzero_block(super_block_buffer);
+    super_block_init(super_block, num_blocks, FS_FEATURES | ((flags & MKFS_INLINE) ? FS_FEATURE_INLINE : 0));
     bzero_block(zero_block);
-    for (i = 0; i < FS_SIZE; i++) {
-        block_write(i, zero_block);
+    for (i = 0; i < super_block->fs_size; i++) {
+        // the log is formatted on its own
+        if (i == super_block->journal_start)
+            i += super_block->journal_count;
+        if (MKFS_ZERO_DATA || !block_is_data(i, super_block))
+            block_write(i, zero_block);
     }
+    journal_format(super_block->journal_start, super_block->journal_count);
 
-    // initialize and write the super block
-    bzero_block(super_block_buffer);
-    super_block_init(super_block, FS_SIZE);
+    // write the super block
     super_block_write(super_block_buffer);
+    alloc_map_init(super_block);
 
     // create the root directory
-    root_dir = inode_read(block_buffer, ROOT_DIRECTORY, super_block);
-    inode_init(root_dir, TYPE_DIRECTORY);
-    inode_write(block_buffer, ROOT_DIRECTORY, super_block);
+    root_dir = vnode_get(ROOT_DIRECTORY, super_block);
+    inode_setup(&root_dir->inode, TYPE_DIRECTORY);
+    vnode_dirty(root_dir);
+    vnode_put(root_dir, super_block);
     working_directory = ROOT_DIRECTORY;
 
     // add "." and ".." to root directory
     i = dir_add(".", ROOT_DIRECTORY, ROOT_DIRECTORY, super_block);
     if (i == -1) {
-        block_write(0, zero_block);
-        block_write(1, zero_block);
+        vnode_init();
+        bcache_write(0, zero_block);
+        bcache_write(1, zero_block);
         return -1;
     }
     i = dir_add("..", ROOT_DIRECTORY, ROOT_DIRECTORY, super_block);
     if (i == -1) {
-        block_write(0, zero_block);
-        block_write(1, zero_block);
+        vnode_init();
+        bcache_write(0, zero_block);
+        bcache_write(1, zero_block);
         return -1;
     }
 
-    // initialize file descriptor table
-    bzero((char *)fd_table, sizeof(fd_table));
+    // every file open on the old file system is gone
+    file_table_init();
+    fs_generation++;
+    fs_sync();
 
     return 0;
 }
 
+// open file_vnode for the calling process in directory dir and return the descriptor. the open
+// file keeps the reference to file_vnode and takes one on dir so rmdir can tell it is in use
+static int fd_open(vnode_t *file_vnode, int flags, int dir) {
+    fdTable *fds = current_fds();
+    vnode_t *dir_vnode;
+    file_t *file;
+    int fd;
+
+    dir_vnode = vnode_get(dir, super_block);
+    file = file_open(file_vnode, flags, dir_vnode);
+    if (file == NULL) {
+        vnode_put(dir_vnode, super_block);
+        return -1;
+    }
+    fd = fd_alloc(fds, file);
+    if (fd == -1) {
+        file_close(file);
+        vnode_put(dir_vnode, super_block);
+        return -1;
+    }
+    return fd;
+}
+
+// close descriptor fd of the calling process and drop the references of its open file
+static void fd_close(int fd) {
+    fdTable *fds = current_fds();
+    file_t *file = fd_lookup(fds, fd);
+    vnode_t *file_vnode = file->vnode;
+    vnode_t *dir_vnode = file->dir_vnode;
+
+    fd_free(fds, fd);
+    file_close(file);
+
+    // if file descriptor count is 0 and we have no links, we can free the inode,
+    // otherwise the last close writes the inode back
+    if (file_vnode->open_count == 0 && file_vnode->inode.links == 0) {
+        inode_free(file_vnode->inode_num, super_block);
+    }
+    else if (file_vnode->open_count == 0) {
+        vnode_write(file_vnode, super_block);
+    }
+
+    vnode_put(file_vnode, super_block);
+    vnode_put(dir_vnode, super_block);
+}
+
 int fs_open( char *fileName, int flags) {
     int file_inode_num;
     int status;
     int dirStatus;
-    inode_t *file_inode;
-    char block_buffer[BLOCK_SIZE];
+    int dir;
+    char name[MAX_FILE_NAME + 1];
+    vnode_t *file_vnode;
 
-    if (verify_filename(fileName) == -1) { return -1; }
     if (!(flags == FS_O_RDONLY || flags == FS_O_WRONLY || flags == FS_O_RDWR)) { return -1; }
+    dir = path_parent(fileName, name);
+    if (dir == -1) { return -1; }
 
     // check if file exists
-    file_inode_num = dir_find(working_directory, fileName, super_block);
+    file_inode_num = dir_find(dir, name, super_block);
 
     // if it exists, check if it is a directory first then open it with permissions
     if (file_inode_num != -1) {
-        file_inode = inode_read(block_buffer, file_inode_num, super_block);
-        if (file_inode->type == TYPE_DIRECTORY && flags != FS_O_RDONLY) { return -1; }
-        status = fd_open(fd_table, file_inode_num, flags, working_directory);
-        if (status == -1) { return -1; }
-        file_inode->fd_count++;
-        inode_write(block_buffer, file_inode_num, super_block);
+        file_vnode = vnode_get(file_inode_num, super_block);
+        if (file_vnode->inode.type == TYPE_DIRECTORY && flags != FS_O_RDONLY) {
+            vnode_put(file_vnode, super_block);
+            return -1;
+        }
+        // the file descriptor keeps the reference to the vnode until it is closed
+        status = fd_open(file_vnode, flags, dir);
+        if (status == -1) {
+            vnode_put(file_vnode, super_block);
+            return -1;
+        }
     }
     // if it doesn't exist, check flags
     else {
         // if flags are read only, then we return -1
         if (flags == FS_O_RDONLY) { return -1; }
         // create the file
-        file_inode_num = get_free_inode(super_block);
+        file_inode_num = get_free_inode(dir, TYPE_FILE, super_block);
         if (file_inode_num == -1) { return -1; }
 
-        file_inode = inode_read(block_buffer, file_inode_num, super_block);
-        inode_init(file_inode, TYPE_FILE);
-        status = fd_open(fd_table, file_inode_num, flags, working_directory);
+        file_vnode = vnode_get(file_inode_num, super_block);
+        inode_setup(&file_vnode->inode, TYPE_FILE);
+        vnode_dirty(file_vnode);
+        status = fd_open(file_vnode, flags, dir);
         if (status == -1) {
+            vnode_put(file_vnode, super_block);
             inode_free(file_inode_num, super_block);
+            fs_commit();
             return -1;
         }
-        file_inode->fd_count++;
-        inode_write(block_buffer, file_inode_num, super_block);
 
-        // add file to current working directory
-        dirStatus = dir_add(fileName, working_directory, file_inode_num, super_block);
+        // add file to its directory
+        dirStatus = dir_add(name, dir, file_inode_num, super_block);
 
         if (dirStatus == -1) {
+            fd_close(status);
             inode_free(file_inode_num, super_block);
-            fd_close(fd_table, status);
+            fs_commit();
             return -1;
         }
+        fs_commit();
     }
 
     return status;
 }
 
 int fs_close( int fd) {
-    int file_inode_num;
-    inode_t *file_inode;
-    char block_buffer[BLOCK_SIZE];
-
     if (verify_open_fd(fd) == -1) { return -1; }
+    fd_close(fd);
+    fs_commit();
 
-    // decrement file descriptor count on inode
-    file_inode_num = fd_table[fd].inode;
-    file_inode = inode_read(block_buffer, file_inode_num, super_block);
-    file_inode->fd_count--;
-    inode_write(block_buffer, file_inode_num, super_block);
+    return 0;
+}
 
-    // if file descriptor count is 0 and we have no links, we can free the inode
-    if (file_inode->fd_count == 0 && file_inode->links == 0) {
-        inode_free(file_inode_num, super_block);
+// close every descriptor the calling process still has open, done when it exits
+void fs_close_all( void) {
+    fdTable *fds = current_fds();
+    int fd;
+
+    if (fd_first(fds) == -1) { return; }
+    while ((fd = fd_first(fds)) != -1) {
+        fd_close(fd);
     }
+    fs_commit();
+}
 
-    // free the file descriptor table entry
-    fd_close(fd_table, fd);
+// a position inside the buffers of a vectored transfer
+typedef struct {
+    ioVec *iov; // the buffers
+    int iovcnt; // number of buffers
+    int index; // buffer the position is in
+    int offset; // bytes of that buffer already transferred
+} io_cursor_t;
+
+// return where the transfer continues in memory and store in *bytes how many bytes follow
+// it in the same buffer
+static char *io_next(io_cursor_t *io, int *bytes) {
+    while (io->index < io->iovcnt && io->offset == io->iov[io->index].len) {
+        io->index++;
+        io->offset = 0;
+    }
+    if (io->index == io->iovcnt) {
+        *bytes = 0;
+        return NULL;
+    }
+    *bytes = io->iov[io->index].len - io->offset;
+    return &io->iov[io->index].base[io->offset];
+}
 
-    return 0;
+// copy bytes between mem and the buffers, crossing from one buffer into the next as needed
+static void io_copy(io_cursor_t *io, char *mem, int bytes, bool_t to_mem) {
+    char *base;
+    int length;
+
+    while (bytes > 0) {
+        base = io_next(io, &length);
+        if (length > bytes)
+            length = bytes;
+        if (to_mem)
+            bcopy((unsigned char *)base, (unsigned char *)mem, length);
+        else
+            bcopy((unsigned char *)mem, (unsigned char *)base, length);
+        io->offset += length;
+        mem += length;
+        bytes -= length;
+    }
 }
 
-static int fs_read_helper(int position, inode_t *file_inode, char *buf, int count) {
+// check a vector of buffers and return the number of bytes it holds, otherwise return -1
+static int io_length(ioVec *iov, int iovcnt) {
+    int i;
+    int total = 0;
+
+    if (iov == NULL || iovcnt < 0 || iovcnt > MAX_IOVECS) { return -1; }
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].len < 0 || (iov[i].base == NULL && iov[i].len > 0)) { return -1; }
+        if (iov[i].len > 0x7fffffff - total) { return -1; }
+        total += iov[i].len;
+    }
+    return total;
+}
+
+static int fs_read_helper(int position, file_t *file, ioVec *iov, int iovcnt, int count) {
+    inode_t *file_inode = &file->vnode->inode;
+    io_cursor_t io = { iov, iovcnt, 0, 0 };
     int data_block_index;
-    int data_block_max;
     int data_block_num;
+    int run;
     int cursor;
     int bytes;
+    int contiguous;
     int upcount;
     int downcount;
+    char *mem;
     char data_block_buffer[BLOCK_SIZE];
-    char *block_pointer;
-    int size;
 
     upcount = 0; // how much we just read
     downcount = count; // how much left to read
 
-    // get the first data block
-    data_block_index = position / BLOCK_SIZE;
-    data_block_max = 1 + (file_inode->size - 1) / BLOCK_SIZE;
+    // never read past the end of the file
+    if (downcount > file_inode->size - position)
+        downcount = file_inode->size - position;
 
-    while (data_block_index < data_block_max && downcount > 0) {
-        // set up data block
-        data_block_num = file_inode->direct_blocks[data_block_index];
-        block_read(data_block_num, data_block_buffer);
+    // an inline file is read straight out of the inode
+    if (file_inode->flags & INODE_INLINE) {
+        io_copy(&io, &file_inode->inline_data[position], downcount, FALSE);
+        return downcount;
+    }
 
-        block_pointer = data_block_buffer;
+    while (downcount > 0) {
+        // find the data block and how many blocks follow it on disk
+        data_block_index = position / BLOCK_SIZE;
         cursor = position % BLOCK_SIZE;
+        data_block_num = fd_bmap(file, data_block_index, &run, super_block);
+        mem = io_next(&io, &contiguous);
 
-        block_pointer += cursor;
-
-        // if cursor is not 0 and we are on the last block with data
-        if (cursor != 0 && data_block_index == data_block_max - 1) {
-            if ((file_inode->size % BLOCK_SIZE == 0) && (file_inode->size / BLOCK_SIZE == data_block_max)) {
-                size = BLOCK_SIZE;
-            }
-            else {
-                size = file_inode->size % BLOCK_SIZE;
-            }
-            // case where amount we want to read is less than the remaining file size
-            if (downcount <= (size - cursor)) {
-                bytes = downcount;
-            }
-            // case where amount we want to read is greater than remaining file size
-            else {
-                bytes = size - cursor;
-            }
-        }
-        // if cursor is not 0 and we want to read less than the remainder of this block
-        else if (cursor != 0 && downcount <= BLOCK_SIZE - cursor) {
-            bytes = downcount;
-        }
-        // if cursor is not 0 and we want to read more than the remainder of this block
-        else if (cursor != 0) {
+        // a hole reads back as zeros
+        if (data_block_num == 0) {
+            bzero_block(data_block_buffer);
             bytes = BLOCK_SIZE - cursor;
-        }
-        // if we are on the last block with data
-        else if (data_block_index == data_block_max - 1) {
-            if ((file_inode->size % BLOCK_SIZE == 0) && (file_inode->size / BLOCK_SIZE == data_block_max)) {
-                size = BLOCK_SIZE;
-            }
-            else {
-                size = file_inode->size % BLOCK_SIZE;
-            }
-            // case where amount we want to read is less than remaining file size
-            if (downcount <= size) {
+            if (bytes > downcount)
                 bytes = downcount;
-            }
-            // case where amount we want to read is greater than remaining file size
-            else {
-                bytes = size;
-            }
+            io_copy(&io, data_block_buffer, bytes, FALSE);
         }
-        // if we want to read less than this block
-        else if (downcount <= BLOCK_SIZE) {
-            bytes = downcount;
+        // whole blocks are copied straight into the buffer, one transfer per run
+        else if (cursor == 0 && downcount >= BLOCK_SIZE && contiguous >= BLOCK_SIZE) {
+            if (run > downcount / BLOCK_SIZE)
+                run = downcount / BLOCK_SIZE;
+            if (run > contiguous / BLOCK_SIZE)
+                run = contiguous / BLOCK_SIZE;
+            bcache_read_multi(data_block_num, run, mem);
+            bytes = run * BLOCK_SIZE;
+            io.offset += bytes;
         }
-        // if we want to read more than this block
+        // otherwise the block is read once and handed out to every buffer that wants part of it
         else {
-            bytes = BLOCK_SIZE;
+            bcache_read(data_block_num, data_block_buffer);
+            bytes = BLOCK_SIZE - cursor;
+            if (bytes > downcount)
+                bytes = downcount;
+            io_copy(&io, &data_block_buffer[cursor], bytes, FALSE);
         }
 
-        // copy from block to buffer
-        bcopy((unsigned char *)block_pointer, (unsigned char *)buf, bytes);
-
         upcount += bytes;
         downcount -= bytes;
         position += bytes;
-        data_block_index++;
-        buf += bytes;
     }
 
-    ASSERT(upcount + downcount == count);
-    ASSERT(downcount >= 0);
-
     return upcount;
 }
 
-int fs_read( int fd, char *buf, int count) {
+// read into the buffers of iov from position of an open file, return the number of bytes read
+static int fd_readv(int fd, ioVec *iov, int iovcnt, int position) {
+    int count;
     int read_count;
-    int file_inode_num;
     inode_t *file_inode;
-    char inode_block_buffer[BLOCK_SIZE];
 
     if (verify_open_fd(fd) == -1) { return -1; }
-    if (fd_table[fd].permissions == FS_O_WRONLY) { return -1; }
-    if (buf == NULL) { return -1; }
-    if (count < 0) { return -1; }
+    if (fd_file(fd)->permissions == FS_O_WRONLY) { return -1; }
+    count = io_length(iov, iovcnt);
+    if (count == -1) { return -1; }
 
-    // get the inode of the file
-    file_inode_num = fd_table[fd].inode;
-    file_inode = inode_read(inode_block_buffer, file_inode_num, super_block);
+    // get the in-core inode of the file
+    file_inode = &fd_file(fd)->vnode->inode;
 
-    // if position in fd is at the end or count is 0 we don't read anything
+    // if position is at the end or count is 0 we don't read anything. no write makes a file
+    // longer than MAX_FILE_BYTES, a larger size is a damaged inode
     if (count == 0) { return 0; }
-    if (fd_table[fd].position >= file_inode->size) { return 0; }
+    if (position >= file_inode->size || position >= MAX_FILE_BYTES) { return 0; }
+
+    read_count = fs_read_helper(position, fd_file(fd), iov, iovcnt, count);
+    if (read_count > 0 && !(file_inode->flags & INODE_INLINE))
+        fd_readahead(fd_file(fd), position, read_count, super_block);
+
+    return read_count;
+}
+
+int fs_read( int fd, char *buf, int count) {
+    ioVec iov;
+    int read_count;
 
-    read_count = fs_read_helper(fd_table[fd].position, file_inode, buf, count);
+    if (verify_open_fd(fd) == -1 || buf == NULL) { return -1; }
+    iov.base = buf;
+    iov.len = count;
+
+    read_count = fd_readv(fd, &iov, 1, fd_file(fd)->position);
+    if (read_count > 0)
+        fd_file(fd)->position += read_count;
+
+    return read_count;
+}
+
+int fs_pread( int fd, char *buf, int count, int offset) {
+    ioVec iov;
+
+    if (buf == NULL || offset < 0) { return -1; }
+    iov.base = buf;
+    iov.len = count;
+    return fd_readv(fd, &iov, 1, offset);
+}
+
+int fs_readv( int fd, ioVec *iov, int iovcnt) {
+    int read_count;
 
-    fd_table[fd].position += read_count;
+    if (verify_open_fd(fd) == -1) { return -1; }
+    read_count = fd_readv(fd, iov, iovcnt, fd_file(fd)->position);
+    if (read_count > 0)
+        fd_file(fd)->position += read_count;
 
     return read_count;
 }
 
-static int fs_write_helper(int position, inode_t *file_inode, char *buf, int count) {
+static int fs_write_helper(int position, file_t *file, ioVec *iov, int iovcnt, int count) {
+    inode_t *file_inode = &file->vnode->inode;
+    io_cursor_t io = { iov, iovcnt, 0, 0 };
     int upcount;
     int downcount;
     int data_block_index;
     int data_block_num;
+    int last_block_index;
+    int run;
     int cursor;
     int bytes;
-    int new_block;
-    int original_use_blocks;
-    int i;
+    int contiguous;
+    int allocated;
+    int fresh_start;
+    int fresh_end;
+    int copied;
+    char *mem;
     char data_block_buffer[BLOCK_SIZE];
-    char zero_block[BLOCK_SIZE];
-    char *block_pointer;
+
+    // a write that fits in the inline area stays in the inode, anything larger first moves
+    // the contents out to a data block
+    if (file_inode->flags & INODE_INLINE) {
+        if (position + count <= INODE_INLINE_SIZE) {
+            io_copy(&io, &file_inode->inline_data[position], count, TRUE);
+            return count;
+        }
+        if (inode_uninline(file_inode, dir_goal(file->dir_vnode, super_block), super_block) == -1) { return -1; }
+        file->vnode->map_gen++;
+    }
 
     upcount = 0; // how much we already wrote
     downcount = count; // how much left to write
-    bzero_block(zero_block);
 
-    // get the first data block
+    // get the first and the last data block, the caller keeps the write below MAX_FILE_BYTES
     data_block_index = position / BLOCK_SIZE;
-
-    // if the pointer is beyond the current end of file, write \0 in the intervening space
-    if (position > file_inode->size) {
-        // get the last used block
-        block_read(file_inode->direct_blocks[file_inode->in_use_blocks - 1], data_block_buffer);
-        // copy zeros from end of file to end of block
-        bcopy((unsigned char *)zero_block, (unsigned char *)&data_block_buffer[file_inode->size % BLOCK_SIZE], BLOCK_SIZE - file_inode->size % BLOCK_SIZE);
-        // write block to disk
-        block_write(file_inode->direct_blocks[file_inode->in_use_blocks - 1], data_block_buffer);
-    }
-    
-    // if we have a first data block that is greater than the current used blocks,
-    // we need to allocate blocks until we get to the first data block
-    if (data_block_index >= file_inode->in_use_blocks) {
-        original_use_blocks = file_inode->in_use_blocks;
-        for (; file_inode->in_use_blocks <= data_block_index; file_inode->in_use_blocks++) {
-            new_block = get_free_data(super_block);
-            // free all other data blocks and return to original state if we can't find new block
-            if (new_block == -1) { 
-                for (i = original_use_blocks; i < file_inode->in_use_blocks; i++) {
-                    data_free(file_inode->direct_blocks[i], super_block);
-                }
-                file_inode->in_use_blocks = original_use_blocks;
-                return -1; 
-            }
-            // write null characters to the new block
-            block_write(new_block, zero_block);
-            file_inode->direct_blocks[file_inode->in_use_blocks] = new_block;
+    last_block_index = (position + count - 1) / BLOCK_SIZE;
+
+    // nothing is allocated for a gap the write skips past the end of the file, it reads back as a
+    // hole. the bytes past the end in the last block are already zero since fresh blocks start out
+    // zeroed
+    fresh_start = fresh_end = 0;
+    copied = -1; // file block whose old contents are already in data_block_buffer
+
+    while (data_block_index <= last_block_index && downcount > 0) {
+        // if the block is a hole or past the end, allocate blocks for it, as many as the
+        // rest of the write needs so they can be laid out in one run
+        data_block_num = fd_bmap(file, data_block_index, &run, super_block);
+        if (data_block_num == 0) {
+            allocated = inode_alloc(file_inode, data_block_index, last_block_index + 1 - data_block_index,
+                                    dir_goal(file->dir_vnode, super_block), super_block);
+            if (allocated == -1) { break; }
+            fresh_start = data_block_index;
+            fresh_end = data_block_index + allocated;
+            // the new blocks may extend a run in the mapping window, refill it
+            file->map_count = 0;
+            data_block_num = fd_bmap(file, data_block_index, &run, super_block);
         }
-    }
-
-    while (data_block_index < DATA_BLOCK_NUM && downcount > 0) {
-        // if file doesn't have data block, we need to get one for it
-        if (data_block_index == file_inode->in_use_blocks) {
-            new_block = get_free_data(super_block);
-            if (new_block == -1) { break; }
-            file_inode->in_use_blocks++;
-            file_inode->direct_blocks[data_block_index] = new_block;
+        // a block shared with a clone gets one of its own before it changes, the part the write
+        // does not cover is copied over. descriptors holding the old mapping have to drop it
+        else if (data_private_run(data_block_num, 1) == 0) {
+            if (position % BLOCK_SIZE != 0 || downcount < BLOCK_SIZE) {
+                bcache_read(data_block_num, data_block_buffer);
+                copied = data_block_index;
+            }
+            if (inode_unshare(file_inode, data_block_index, super_block) == -1) { break; }
+            file->vnode->map_gen++;
+            data_block_num = fd_bmap(file, data_block_index, &run, super_block);
         }
+        // the blocks of a run past the next shared one wait until the write gets to it
+        run = data_private_run(data_block_num, run);
 
-        // set up data block
-        data_block_num = file_inode->direct_blocks[data_block_index];
-        block_read(data_block_num, data_block_buffer);
-
-        block_pointer = data_block_buffer;
         cursor = position % BLOCK_SIZE;
-
-        block_pointer += cursor;
-
-        // if cursor is not 0
-        if (cursor != 0) {
-            // if the amount we want to write is less than the end of the block
-            if (downcount <= BLOCK_SIZE - cursor) {
-                bytes = downcount;
-            }
-            else {
-                bytes = BLOCK_SIZE - cursor;
-            }
-        }
-        // if we want to write less than this block
-        else if (downcount <= BLOCK_SIZE) {
-            bytes = downcount;
+        mem = io_next(&io, &contiguous);
+
+        // whole blocks are copied straight from the buffer, one transfer per run
+        if (cursor == 0 && downcount >= BLOCK_SIZE && contiguous >= BLOCK_SIZE) {
+            if (run > downcount / BLOCK_SIZE)
+                run = downcount / BLOCK_SIZE;
+            if (run > contiguous / BLOCK_SIZE)
+                run = contiguous / BLOCK_SIZE;
+            bcache_write_multi(data_block_num, run, mem);
+            bytes = run * BLOCK_SIZE;
+            io.offset += bytes;
         }
-        // if we want to write more than this block
+        // otherwise read the block, gather every buffer's part of it and write it back once
         else {
-            bytes = BLOCK_SIZE;
+            bytes = BLOCK_SIZE - cursor;
+            if (bytes > downcount)
+                bytes = downcount;
+            // blocks this write allocated hold nothing worth reading
+            if (data_block_index >= fresh_start && data_block_index < fresh_end)
+                bzero_block(data_block_buffer);
+            else if (bytes < BLOCK_SIZE && data_block_index != copied)
+                bcache_read(data_block_num, data_block_buffer);
+            io_copy(&io, &data_block_buffer[cursor], bytes, TRUE);
+            bcache_write_data(data_block_num, data_block_buffer);
         }
 
-        // write from buffer to data block
-        bcopy((unsigned char *)buf, (unsigned char *)block_pointer, bytes);
-        // write data block to disk
-        block_write(data_block_num, data_block_buffer);
-
         upcount += bytes;
         downcount -= bytes;
         position += bytes;
-        data_block_index++;
-        buf += bytes;
+        data_block_index = position / BLOCK_SIZE;
     }
 
     return upcount;
 }
     
-int fs_write( int fd, char *buf, int count) {
+// write the buffers of iov at position of an open file, return the number of bytes written
+static int fd_writev(int fd, ioVec *iov, int iovcnt, int position) {
+    int count;
     int write_count;
-    int file_inode_num;
+    vnode_t *file_vnode;
     inode_t *file_inode;
-    char inode_block_buffer[BLOCK_SIZE];
 
     if (verify_open_fd(fd) == -1) { return -1; }
-    if (fd_table[fd].permissions == FS_O_RDONLY) { return -1; }
-    if (buf == NULL) { return -1; }
-    if (count < 0) { return -1; }
+    if (fd_file(fd)->permissions == FS_O_RDONLY) { return -1; }
+    count = io_length(iov, iovcnt);
+    if (count == -1) { return -1; }
 
     // if count is greater than 0 but the file position is at the end (no bytes are written)
-    if (count > 0 && fd_table[fd].position == BLOCK_SIZE * DATA_BLOCK_NUM) { return -1; }
+    if (count > 0 && position >= MAX_FILE_BYTES) { return -1; }
     // if count is 0 return 0 and do nothing
     if (count == 0) { return 0; }
+    // a write that would run past the largest file stops there
+    if (count > MAX_FILE_BYTES - position)
+        count = MAX_FILE_BYTES - position;
 
-    // get the inode of the file
-    file_inode_num = fd_table[fd].inode;
-    file_inode = inode_read(inode_block_buffer, file_inode_num, super_block);
+    // get the in-core inode of the file, it is written back when the file is closed
+    file_vnode = fd_file(fd)->vnode;
+    file_inode = &file_vnode->inode;
 
-    write_count = fs_write_helper(fd_table[fd].position, file_inode, buf, count);
+    write_count = fs_write_helper(position, fd_file(fd), iov, iovcnt, count);
+    vnode_dirty(file_vnode);
 
-    if (write_count == -1) { return -1; }
+    if (write_count == -1) {
+        fs_commit();
+        return -1;
+    }
+
+    if (position + write_count > file_inode->size)
+        file_inode->size = position + write_count;
+
+    fs_commit();
+
+    return write_count;
+}
+
+int fs_write( int fd, char *buf, int count) {
+    ioVec iov;
+    int write_count;
+
+    if (verify_open_fd(fd) == -1 || buf == NULL) { return -1; }
+    iov.base = buf;
+    iov.len = count;
+
+    write_count = fd_writev(fd, &iov, 1, fd_file(fd)->position);
+    if (write_count > 0)
+        fd_file(fd)->position += write_count;
+
+    return write_count;
+}
 
-    fd_table[fd].position += write_count;
-    if (fd_table[fd].position > file_inode->size)
-        file_inode->size = fd_table[fd].position;
+int fs_pwrite( int fd, char *buf, int count, int offset) {
+    ioVec iov;
+
+    if (buf == NULL || offset < 0) { return -1; }
+    iov.base = buf;
+    iov.len = count;
+    return fd_writev(fd, &iov, 1, offset);
+}
 
-    inode_write(inode_block_buffer, file_inode_num, super_block);
+int fs_writev( int fd, ioVec *iov, int iovcnt) {
+    int write_count;
+
+    if (verify_open_fd(fd) == -1) { return -1; }
+    write_count = fd_writev(fd, iov, iovcnt, fd_file(fd)->position);
+    if (write_count > 0)
+        fd_file(fd)->position += write_count;
 
     return write_count;
 }
@@ -429,33 +724,37 @@ int fs_write( int fd, char *buf, int count) {
 int fs_lseek( int fd, int offset) {
     if (verify_open_fd(fd) == -1) { return -1; }
     if (offset < 0) { return -1; }
-    fd_table[fd].position = offset;
+    fd_file(fd)->position = offset;
     return offset;
 }
 
 int fs_mkdir( char *fileName) {
     int status;
     int inode_num;
-    inode_t *inode;
-    char block_buffer[BLOCK_SIZE];
+    int dir;
+    char name[MAX_FILE_NAME + 1];
+    vnode_t *vnode;
 
     // check if fileName is valid or if directory name already exists
-    if (verify_filename(fileName) == -1) { return -1; }
-    status = dir_find(working_directory, fileName, super_block);
+    dir = path_parent(fileName, name);
+    if (dir == -1) { return -1; }
+    status = dir_find(dir, name, super_block);
     if (status != -1) { return -1; }
 
     // allocate a new inode for this directory
-    inode_num = get_free_inode(super_block);
+    inode_num = get_free_inode(dir, TYPE_DIRECTORY, super_block);
     if (inode_num == -1) { return -1; }
     // initialize the inode into a directory
-    inode = inode_read(block_buffer, inode_num, super_block);
-    inode_init(inode, TYPE_DIRECTORY);
-    inode_write(block_buffer, inode_num, super_block);
+    vnode = vnode_get(inode_num, super_block);
+    inode_setup(&vnode->inode, TYPE_DIRECTORY);
+    vnode_dirty(vnode);
+    vnode_put(vnode, super_block);
 
-    // try to put this inode into current directory
-    status = dir_add(fileName, working_directory, inode_num, super_block);
+    // try to put this inode into its parent directory
+    status = dir_add(name, dir, inode_num, super_block);
     if (status == -1) { 
         inode_free(inode_num, super_block);
+        fs_commit();
         return -1; 
     }
 
@@ -463,68 +762,75 @@ int fs_mkdir( char *fileName) {
     status = dir_add(".", inode_num, inode_num, super_block);
     if (status == -1) {
         inode_free(inode_num, super_block);
-        dir_remove(working_directory, fileName, super_block);
+        dir_remove(dir, name, super_block);
+        fs_commit();
         return -1;
     }
-    status = dir_add("..", inode_num, working_directory, super_block);
+    status = dir_add("..", inode_num, dir, super_block);
     if (status == -1) {
         inode_free(inode_num, super_block);
-        dir_remove(working_directory, fileName, super_block);
+        dir_remove(dir, name, super_block);
+        fs_commit();
         return -1;
     }
+    fs_commit();
 
     return 0;
 }
 
 int fs_rmdir( char *fileName) {
     int inode_num;
-    inode_t *inode;
-    char block_buffer[BLOCK_SIZE];
+    int dir;
+    char name[MAX_FILE_NAME + 1];
+    vnode_t *vnode;
+
+    // get the directory from its parent
+    dir = path_parent(fileName, name);
+    if (dir == -1) { return -1; }
 
     // can't remove these from the directory
-    if (same_string(fileName, ".") || same_string(fileName, "..")) {
+    if (same_string(name, ".") || same_string(name, "..")) {
         return -1;
     }
 
-    // get the directory from current directory
-    if (verify_filename(fileName) == -1) { return -1; }
-    inode_num = dir_find(working_directory, fileName, super_block);
-    if (inode_num == -1) { return -1; }
+    inode_num = dir_find(dir, name, super_block);
+    if (inode_num == -1 || inode_num == working_directory) { return -1; }
 
     // check if the directory is valid and empty
-    inode = inode_read(block_buffer, inode_num, super_block);
-    if (inode->type != TYPE_DIRECTORY) { return -1; }
-    if (inode->size != 2 * sizeof(directory_entry_t)) { return -1; }
+    vnode = vnode_get(inode_num, super_block);
+    if (vnode->inode.type != TYPE_DIRECTORY || !dir_is_empty(inode_num, super_block)) {
+        vnode_put(vnode, super_block);
+        return -1;
+    }
 
-    // check if the file descriptor table has any file descriptors for this directory
-    if (fd_dir_search(fd_table, inode_num) == 0) { return -1; }
+    // check if any open file was opened in this directory
+    if (vnode->dir_open_count > 0) {
+        vnode_put(vnode, super_block);
+        return -1;
+    }
 
-    // remove the directory
-    dir_remove(working_directory, fileName, super_block);
+    // remove the directory and forget the names cached for it
+    dir_remove(dir, name, super_block);
+    dcache_purge_dir(inode_num);
 
     // decrement its links
-    inode->links--;
-    if (inode->links == 0) {
+    vnode->inode.links--;
+    vnode_dirty(vnode);
+    if (vnode->inode.links == 0) {
         inode_free(inode_num, super_block);
     }
-    else {
-        inode_write(block_buffer, inode_num, super_block);
-    }
+    vnode_put(vnode, super_block);
+    fs_commit();
 
     return 0;
 }
 
 int fs_cd( char *dirName) {
     int inode_num;
-    inode_t *inode;
-    char block_buffer[BLOCK_SIZE];
 
-    if (verify_filename(dirName) == -1) { return -1; }
-    inode_num = dir_find(working_directory, dirName, super_block);
+    inode_num = path_lookup(dirName);
     if (inode_num == -1) { return -1; }
-
-    inode = inode_read(block_buffer, inode_num, super_block);
-    if (inode->type != TYPE_DIRECTORY) { return -1; }
+    if (inode_type(inode_num) != TYPE_DIRECTORY) { return -1; }
 
     working_directory = inode_num;
 
@@ -534,134 +840,234 @@ int fs_cd( char *dirName) {
 int fs_link( char *old_fileName, char *new_fileName) {
     int status;
     int inode_num;
-    inode_t *file_inode;
-    char block_buffer[BLOCK_SIZE];
+    int dir;
+    char name[MAX_FILE_NAME + 1];
+    vnode_t *file_vnode;
 
-    if (verify_filename(old_fileName) == -1 || verify_filename(new_fileName) == -1) { return -1; }
-    if (dir_find(working_directory, new_fileName, super_block) != -1) { return -1; }
+    dir = path_parent(new_fileName, name);
+    if (dir == -1) { return -1; }
+    if (dir_find(dir, name, super_block) != -1) { return -1; }
 
-    // look for old_fileName in the directory. If not found return -1
-    inode_num = dir_find(working_directory, old_fileName, super_block);
+    // look for old_fileName. If not found return -1
+    inode_num = path_lookup(old_fileName);
     if (inode_num == -1) { return -1; }
 
-    file_inode = inode_read(block_buffer, inode_num, super_block);
-    if (file_inode->type == TYPE_DIRECTORY) { return -1; }
-    inode_write(block_buffer, inode_num, super_block);
+    file_vnode = vnode_get(inode_num, super_block);
+    if (file_vnode->inode.type == TYPE_DIRECTORY) {
+        vnode_put(file_vnode, super_block);
+        return -1;
+    }
 
     // if found, we make a new entry for the new_fileName
-    status = dir_add(new_fileName, working_directory, inode_num, super_block);
-    if (status == -1) { return -1; }
+    status = dir_add(name, dir, inode_num, super_block);
+    if (status == -1) {
+        vnode_put(file_vnode, super_block);
+        fs_commit();
+        return -1;
+    }
 
     // increment the link on file inode
-    file_inode = inode_read(block_buffer, inode_num, super_block);
-    file_inode->links++;
-    inode_write(block_buffer, inode_num, super_block);
+    file_vnode->inode.links++;
+    vnode_dirty(file_vnode);
+    vnode_put(file_vnode, super_block);
+    fs_commit();
     
     return 0;
 }
 
+// make new_fileName a copy of old_fileName that shares its data blocks until either one writes
+// to them, so cloning takes time in proportion to the block mapping instead of the data
+int fs_clone( char *old_fileName, char *new_fileName) {
+    int status;
+    int inode_num;
+    int clone_inode_num;
+    int dir;
+    char name[MAX_FILE_NAME + 1];
+    vnode_t *file_vnode;
+    vnode_t *clone_vnode;
+
+    dir = path_parent(new_fileName, name);
+    if (dir == -1) { return -1; }
+    if (dir_find(dir, name, super_block) != -1) { return -1; }
+
+    // only files can be cloned
+    inode_num = path_lookup(old_fileName);
+    if (inode_num == -1) { return -1; }
+    file_vnode = vnode_get(inode_num, super_block);
+    if (file_vnode->inode.type != TYPE_FILE) {
+        vnode_put(file_vnode, super_block);
+        return -1;
+    }
+
+    clone_inode_num = get_free_inode(dir, TYPE_FILE, super_block);
+    if (clone_inode_num == -1) {
+        vnode_put(file_vnode, super_block);
+        return -1;
+    }
+    clone_vnode = vnode_get(clone_inode_num, super_block);
+    inode_setup(&clone_vnode->inode, TYPE_FILE);
+    status = inode_clone(&clone_vnode->inode, &file_vnode->inode, super_block);
+    vnode_dirty(clone_vnode);
+    vnode_put(clone_vnode, super_block);
+    vnode_put(file_vnode, super_block);
+
+    if (status == 0)
+        status = dir_add(name, dir, clone_inode_num, super_block);
+    if (status == -1)
+        inode_free(clone_inode_num, super_block);
+    fs_commit();
+
+    return status;
+}
+
 int fs_unlink( char *fileName) {
     int file_inode_num;
-    inode_t *file_inode;
-    char block_buffer[BLOCK_SIZE];
+    int dir;
+    char name[MAX_FILE_NAME + 1];
+    vnode_t *file_vnode;
 
-    if (verify_filename(fileName) == -1) { return -1; }
     // fine the inode of the fileName
-    file_inode_num = dir_find(working_directory, fileName, super_block);
+    dir = path_parent(fileName, name);
+    if (dir == -1) { return -1; }
+    file_inode_num = dir_find(dir, name, super_block);
     // if not found we will return -1
     if (file_inode_num == -1) { return -1; }
     // if it is a directory return -1
-    file_inode = inode_read(block_buffer, file_inode_num, super_block);
-    if (file_inode->type == TYPE_DIRECTORY) { return -1; }
+    file_vnode = vnode_get(file_inode_num, super_block);
+    if (file_vnode->inode.type == TYPE_DIRECTORY) {
+        vnode_put(file_vnode, super_block);
+        return -1;
+    }
 
     // decrement its link
-    file_inode->links--;
-    inode_write(block_buffer, file_inode_num, super_block);
+    file_vnode->inode.links--;
+    vnode_dirty(file_vnode);
 
-    // if links and fd_count are both 0 we can delete the inode
-    if (file_inode->links == 0 && file_inode->fd_count == 0) {
+    // if links and open count are both 0 we can delete the inode
+    if (file_vnode->inode.links == 0 && file_vnode->open_count == 0) {
         inode_free(file_inode_num, super_block);
     }
+    vnode_put(file_vnode, super_block);
 
     // remove entry from directory
-    dir_remove(working_directory, fileName, super_block);
+    dir_remove(dir, name, super_block);
+    fs_commit();
 
     return 0;
 }
 
 int fs_stat( char *fileName, fileStat *buf) {
     int inode_num;
+    vnode_t *vnode;
     inode_t *inode;
-    char block_buffer[BLOCK_SIZE];
 
     if (fileName == NULL || buf == NULL) { return -1; }
 
-    inode_num = dir_find(working_directory, fileName, super_block);
+    inode_num = path_lookup(fileName);
     if (inode_num == -1) { return -1; }
-    inode = inode_read(block_buffer, inode_num, super_block);
+    vnode = vnode_get(inode_num, super_block);
+    inode = &vnode->inode;
 
     buf->inodeNo = inode_num;
     buf->type = (short) inode->type;
     buf->links = (char) inode->links;
     buf->size = (int) inode->size;
-    buf->numBlocks = (int) inode->in_use_blocks;
+    buf->numBlocks = (int) inode->allocated_blocks;
+    // inline contents count as the one block they would fill, so sizes stay comparable
+    if ((inode->flags & INODE_INLINE) && inode->size > 0) { buf->numBlocks = 1; }
+    buf->numExtents = inode_runs(inode, super_block);
+    vnode_put(vnode, super_block);
 
     return 0;
 }
 
-static void print_one(inode_t *inode, char *name, int inode_num) {
-    char spaces[] = "                                 ";
-    writeStr(name);
-    // print 32 - length(name) + 1 spaces
-    spaces[MAX_FILE_NAME_COPY - strlen(name) + 1] = '\0';
-    writeStr(spaces);
-    
-    if (inode->type == TYPE_DIRECTORY) {
-        writeStr("D    ");
-    }
-    else {
-        writeStr("F    ");
-    }
-    writeInt(inode_num);
-    writeStr("     ");
-    writeInt(inode->size);
-    writeStr("\n");
-}
-
-void fs_ls( void) {
-    inode_t *entry_inode;
-    char inode_block_buffer[BLOCK_SIZE];
-    inode_t *directory_inode;
-    char dir_block_buffer[BLOCK_SIZE];
-    char block_buffer[BLOCK_SIZE];
-    int block_index;
-    int block_max;
-    int numEntries;
-    int i;
-    directory_entry_t *directory_entries;
+int fs_sync( void) {
+    vnode_sync(super_block);
+    alloc_map_flush(super_block);
+    journal_checkpoint();
+    return 0;
+}
 
-    directory_inode = inode_read(dir_block_buffer, working_directory, super_block);
-    block_max = directory_inode->in_use_blocks;
+// make the changes to one open file durable: its dirty data blocks go home, then its metadata
+// reaches the log. the data of other files stays in the cache and the log is not emptied
+int fs_fsync( int fd) {
+    if (verify_open_fd(fd) == -1) { return -1; }
+    inode_flush(&fd_file(fd)->vnode->inode, super_block);
+    // the running transaction holds the metadata of every operation since the last commit,
+    // committing only part of it would leave the log inconsistent
+    vnode_sync(super_block);
+    alloc_map_flush(super_block);
+    journal_commit();
+    // without a log metadata is only durable once it is home
+    if (super_block->journal_count == 0)
+        bcache_flush();
+    return 0;
+}
 
-    writeStr("Name                             Type Inode Size\n");
+int fs_info( fsInfo *buf) {
+    bcache_stats_t stats;
+    journal_stats_t log_stats;
+    uint32_t name_hits, name_misses;
 
-    for (block_index = 0; block_index < block_max; block_index++) {
-        // read a data block and get the directory entries
-        block_read((int) (directory_inode->direct_blocks[block_index]), block_buffer);
-        directory_entries = (directory_entry_t *)block_buffer;
+    if (buf == NULL) { return -1; }
 
-        // see how many entries are in this data block
-        if (block_index == block_max - 1) {
-            numEntries = (directory_inode->size % BLOCK_SIZE) / sizeof(directory_entry_t);
-        }
-        else {
-            numEntries = BLOCK_SIZE / sizeof(directory_entry_t);
-        }
-        // print the names of all the data blocks
-        for (i = 0; i < numEntries; i++) {
-            entry_inode = inode_read(inode_block_buffer, directory_entries[i].inode, super_block);
-            print_one(entry_inode, directory_entries[i].name, directory_entries[i].inode);
-        }
-    }
+    bcache_get_stats(&stats);
+    buf->cacheHits = (int) stats.hits;
+    buf->cacheMisses = (int) stats.misses;
+    buf->diskReads = (int) stats.disk_reads;
+    buf->diskWrites = (int) stats.disk_writes;
+    buf->raHits = (int) stats.ra_hits;
+    buf->raWasted = (int) stats.ra_wasted;
+    dcache_get_stats(&name_hits, &name_misses);
+    buf->nameHits = (int) name_hits;
+    buf->nameMisses = (int) name_misses;
+    journal_get_stats(&log_stats);
+    buf->logCommits = (int) log_stats.commits;
+    buf->logBlocks = (int) log_stats.log_blocks;
+    buf->logCheckpoints = (int) log_stats.checkpoints;
+    buf->blockSize = (int) super_block->block_size;
+    buf->numBlocks = (int) super_block->fs_size;
+    buf->freeBlocks = data_free_count();
+    buf->numGroups = (int) super_block->group_count;
+    buf->freeInodes = inode_free_count();
+    buf->sharedBlocks = data_shared_count();
+
+    return 0;
 }
 
+// check the file system and with repair set fix what is wrong. everything cached is written home
+// and the log emptied first, so the checker sees the disk the way the next mount would
+int fs_fsck( fsckInfo *buf, int repair) {
+    if (buf == NULL) { return -1; }
+
+    fs_sync();
+    fsck_check(buf, repair != 0, super_block);
+    fs_sync();
+
+    return 0;
+}
+
+// copy up to count entries of an open directory into buf, starting at the position of the
+// descriptor, and move the position past them. return how many were copied, 0 at the end
+int fs_getdents( int fd, dirEnt *buf, int count) {
+    file_t *file = fd_file(fd);
+    directory_entry_t entry;
+    int position;
+    int n = 0;
+
+    if (file == NULL || buf == NULL || count < 0) { return -1; }
+    if (file->vnode->inode.type != TYPE_DIRECTORY) { return -1; }
+
+    position = file->position;
+    while (n < count && dir_next_entry(file->vnode->inode_num, &position, &entry, super_block) == 0) {
+        buf[n].inodeNo = entry.inode;
+        bcopy((unsigned char *)entry.name, (unsigned char *)buf[n].name, MAX_FILE_NAME_COPY);
+        buf[n].cookie = position;
+        n++;
+    }
+    file->position = position;
+
+    // then the type and size of the whole batch, reading each inode block once
+    vnode_fill_records(buf, n, super_block);
+    return n;
+}
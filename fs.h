@@ -6,23 +6,47 @@
 #ifndef FS_INCLUDED
 #define FS_INCLUDED
 
+// size in blocks of the file system mkfs lays out when it is not given one
+#ifndef FS_SIZE
 #define FS_SIZE 2048
+#endif
+
+// the allocation maps stay in memory, so they are sized for the largest file system mkfs accepts
+#ifndef FS_MAX_SIZE
+#define FS_MAX_SIZE 16384
+#endif
+#define FS_MIN_SIZE 256 // smallest file system that still has room for data after the log
+
+// mkfs only writes the metadata blocks unless this is 1; a data block is never read
+// before it is written, and a block that is only partly written is zeroed first
+#ifndef MKFS_ZERO_DATA
+#define MKFS_ZERO_DATA 0
+#endif
 
 void fs_init( void);
-int fs_mkfs( void);
+int fs_mkfs( int numBlocks, int blockSize, int flags);
 int fs_open( char *fileName, int flags);
 int fs_close( int fd);
+void fs_close_all( void);
 int fs_read( int fd, char *buf, int count);
 int fs_write( int fd, char *buf, int count);
 int fs_lseek( int fd, int offset);
+int fs_pread( int fd, char *buf, int count, int offset);
+int fs_pwrite( int fd, char *buf, int count, int offset);
+int fs_readv( int fd, ioVec *iov, int iovcnt);
+int fs_writev( int fd, ioVec *iov, int iovcnt);
 int fs_mkdir( char *fileName);
 int fs_rmdir( char *fileName);
 int fs_cd( char *dirName);
 int fs_link( char *old_fileName, char *new_fileName);
+int fs_clone( char *old_fileName, char *new_fileName);
 int fs_unlink( char *fileName);
 int fs_stat( char *fileName, fileStat *buf);
-void fs_ls( void);
+int fs_getdents( int fd, dirEnt *buf, int count);
+int fs_sync( void);
+int fs_fsync( int fd);
+int fs_info( fsInfo *buf);
+int fs_fsck( fsckInfo *buf, int repair);
 
-#define MAX_FILE_NAME 32
-#define MAX_PATH_NAME 256  // This is the maximum supported "full" path len, eg: /foo/bar/test.txt, rather than the maximum individual filename len.
+#define MAX_IOVECS 16 // most buffers one fs_readv or fs_writev call takes
 #endif
@@ -6,7 +6,10 @@
 #include "util.h"
 #include "common.h"
 #include "block.h"
+#include "bcache.h"
+#include "fs.h"
 #include "fs_helpers.h"
+#include "journal.h"
 
 #ifdef FAKE
 #include <stdio.h>
@@ -17,339 +20,2623 @@
 
 // SUPER BLOCK STUFF
 
-// initialize super block
-void super_block_init(super_block_t *sblock, int fs_size) {
-    ASSERT(fs_size >= 22); // this needs to be true otherwise max_num_inodes will be 0
+// number of inodes a group of size blocks gets: 75% of its blocks and always a multiple of 16
+static int group_size_inodes(int size) {
+    return (((uint32_t) (0.75 * size)) / 16) * 16;
+}
+
+// work out where group lies on disk for the geometry in sblock, leaving its free counts alone
+static void group_layout(group_desc_t *desc, int group, super_block_t *sblock) {
+    int start = group * GROUP_BLOCKS;
+    int size = sblock->fs_size - start;
+
+    if (size > GROUP_BLOCKS)
+        size = GROUP_BLOCKS;
+    desc->inodes = group_size_inodes(size);
+    if (desc->inodes > sblock->group_inodes)
+        desc->inodes = sblock->group_inodes;
+    // group 0 has the blocks shared by the whole file system in front of its own
+    desc->block_map = (group == 0) ? sblock->journal_start + sblock->journal_count : start;
+    desc->inode_map = desc->block_map + 1;
+    desc->inode_table = desc->inode_map + 1;
+    desc->data_start = desc->inode_table + (desc->inodes + INODES_PER_BLOCK(sblock) - 1) / INODES_PER_BLOCK(sblock);
+    desc->data_count = start + size - desc->data_start;
+}
+
+// initialize super block for a file system of fs_size blocks made with features
+void super_block_init(super_block_t *sblock, int fs_size, int features) {
+    group_desc_t last;
+
+    ASSERT(fs_size >= FS_MIN_SIZE && fs_size <= FS_MAX_SIZE);
+    // a last group with too few blocks to be worth its own maps is left out
+    if (fs_size % GROUP_BLOCKS < GROUP_MIN_BLOCKS && fs_size > GROUP_BLOCKS)
+        fs_size -= fs_size % GROUP_BLOCKS;
     sblock->magic_num = MAGIC_NUM;
     sblock->fs_size = fs_size;
-    sblock->inode_start = 1;
-    sblock->max_num_inodes = (((uint32_t) (0.75 * fs_size)) / 16) * 16; // 75% of FS_SIZE and always a multiple of 16
-    sblock->inode_count = 1 + (sblock->max_num_inodes - 1) / (BLOCK_SIZE / sizeof(inode_t));
-    sblock->ba_map_start = sblock->inode_start + sblock->inode_count;
-    sblock->ba_map_count = 1 + (fs_size - 1) / BLOCK_SIZE;
-    sblock->data_start = sblock->ba_map_start + sblock->ba_map_count;
-    sblock->data_count = fs_size - 1 - sblock->inode_count - sblock->ba_map_count;
+    sblock->group_count = 1 + (fs_size - 1) / GROUP_BLOCKS;
+    sblock->group_inodes = group_size_inodes((fs_size < GROUP_BLOCKS) ? fs_size : GROUP_BLOCKS);
+    // directory entries cannot name more than MAX_NUM_INODES inodes
+    if (sblock->group_inodes * sblock->group_count > MAX_NUM_INODES)
+        sblock->group_inodes = MAX_NUM_INODES / sblock->group_count / 16 * 16;
+    sblock->group_table_start = 1;
+    sblock->group_table_count = 1 + (sblock->group_count - 1) / GROUP_DESCS_PER_BLOCK;
+    sblock->ref_table_start = sblock->group_table_start + sblock->group_table_count;
+    sblock->ref_table_count = 1 + (fs_size - 1) / BLOCK_SIZE;
+    sblock->journal_start = sblock->ref_table_start + sblock->ref_table_count;
+    sblock->journal_count = (features & FS_FEATURE_JOURNAL) ? JOURNAL_BLOCKS : 0;
+    sblock->version = FS_VERSION;
+    sblock->features = features;
+    sblock->block_size = BLOCK_SIZE;
+    // inline data is kept in the inode, so only a file system with it pays for the larger inodes
+    sblock->inode_size = (features & FS_FEATURE_INLINE) ? sizeof(inode_t) : INODE_BASE_SIZE;
+
+    group_layout(&last, 0, sblock);
+    ASSERT(last.data_count > 0);
+    group_layout(&last, sblock->group_count - 1, sblock);
+    sblock->max_num_inodes = (sblock->group_count - 1) * sblock->group_inodes + last.inodes;
 }
 
 // read in the super block from the file system
 super_block_t *super_block_read(char *block_buffer) {
-    block_read(SUPER_BLOCK, block_buffer);
+    bcache_read(SUPER_BLOCK, block_buffer);
     return (super_block_t *)block_buffer;
 }
 
 // write the super block to the file system
 void super_block_write(char *block_buffer) {
-    block_write(SUPER_BLOCK, block_buffer);
+    bcache_write(SUPER_BLOCK, block_buffer);
 }
 
-// DATA BLOCK STUFF
+// ALLOCATION MAP STUFF
 
-// look in the block allocation map to find a free data block
-int get_free_data(super_block_t *super_block) {
-    int i, j;
-    char block_buffer[BLOCK_SIZE];
+// an allocation map stays resident in memory, one bit per object (1 = in use). it is made of one
+// block per allocation group, and each block lives on disk in its own group
+typedef struct {
+    uint32_t words[MAP_WORDS];
+    bool_t dirty[MAP_MAX_BLOCKS]; // map blocks changed since the last flush
+    int where[MAP_MAX_BLOCKS]; // disk block holding each block of the map
+    int sizes[MAP_MAX_BLOCKS]; // objects each block tracks, the bits past them are always set
+    int group_free[MAP_MAX_BLOCKS]; // objects each block has free
+    int count; // number of blocks of the map, one per group
+    int hint; // word to start the next free search from
+    int free; // number of objects that are free
+} alloc_map_t;
 
-    for (i = super_block->ba_map_start; i < super_block->data_start; i++) {
-        block_read(i, block_buffer);
-        for (j = 0; j < BLOCK_SIZE; j++) {
-            int index = (i - super_block->ba_map_start) * BLOCK_SIZE + j;
-            if (index >= super_block->fs_size) { return -1; }
-            if (index < super_block->data_start) { continue; }
-            if (!block_buffer[j]) {
-                block_buffer[j] = TRUE;
-                block_write(i, block_buffer);
-                return index;
-            }
-        }
-    }
+static alloc_map_t ba_map; // block allocation map, bit n is block n
+static alloc_map_t ino_map; // inode allocation map, block g tracks the inodes of group g
 
-    return -1;
+#define MAP_WORDS_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t))
+
+static void map_set(alloc_map_t *map, int index) {
+    map->words[index / 32] |= ((uint32_t) 1 << (index % 32));
+    map->dirty[index / MAP_BITS_PER_BLOCK] = TRUE;
+    map->group_free[index / MAP_BITS_PER_BLOCK]--;
+    map->free--;
 }
 
-// free a data block by setting its block allocation map entry to FALSE
-void data_free(int data_block, super_block_t *super_block) {
-    char block_buffer[BLOCK_SIZE];
-    if (data_block >= super_block->fs_size) { return; }
-    if (data_block < super_block->data_start) { return; }
-    // first zero out the data block
-    bzero_block(block_buffer);
-    block_write(data_block, block_buffer);
-    // get the block allocation block and set corresponding entry to FALSE
-    int ba_map_block = super_block->ba_map_start + (data_block / BLOCK_SIZE);
-    block_read(ba_map_block, block_buffer);
-    block_buffer[data_block % BLOCK_SIZE] = FALSE;
-    block_write(ba_map_block, block_buffer);
+static void map_clear(alloc_map_t *map, int index) {
+    map->words[index / 32] &= ~((uint32_t) 1 << (index % 32));
+    map->dirty[index / MAP_BITS_PER_BLOCK] = TRUE;
+    map->group_free[index / MAP_BITS_PER_BLOCK]++;
+    map->free++;
 }
 
-// INODE STUFF
+static bool_t map_test(alloc_map_t *map, int index) {
+    return (map->words[index / 32] >> (index % 32)) & 1;
+}
 
-// initialize a new inode
-void inode_init(inode_t *inode, int type) {
-    inode->size = 0;
-    inode->fd_count = 0;
-    inode->links = 1;
-    inode->in_use_blocks = 0;
-    inode->type = type;
-    bzero((char *)inode->direct_blocks, sizeof(inode->direct_blocks));
+// number of bits set in word. __builtin_popcount becomes a libgcc call the kernel does not link with
+static int bit_count(uint32_t word) {
+    word = word - ((word >> 1) & 0x55555555);
+    word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+    word = (word + (word >> 4)) & 0x0f0f0f0f;
+    return (word * 0x01010101) >> 24;
 }
 
-// get a free inode and return its index, otherwise return -1
-int get_free_inode(super_block_t *super_block) {
-    int block;
-    int index;
-    char inode_block_buffer[BLOCK_SIZE];
-    inode_t *inodes;
+// mark the bits of map block i past its last object as in use so the search never returns them
+static void map_mark_tail(alloc_map_t *map, int i) {
+    int bit;
+    for (bit = i * MAP_BITS_PER_BLOCK + map->sizes[i]; bit < (i + 1) * MAP_BITS_PER_BLOCK; bit++) {
+        map->words[bit / 32] |= ((uint32_t) 1 << (bit % 32));
+    }
+}
+
+// set up an empty map of count blocks, each one placed by map_place
+static void map_init(alloc_map_t *map, int count) {
+    ASSERT(count <= MAP_MAX_BLOCKS);
+    bzero((char *)map, sizeof(alloc_map_t));
+    map->count = count;
+}
+
+// block i of the map is stored on disk at where and tracks size objects, all of them free
+static void map_place(alloc_map_t *map, int i, int where, int size) {
+    map->where[i] = where;
+    map->sizes[i] = size;
+    map->group_free[i] = size;
+    map->free += size;
+    map_mark_tail(map, i);
+}
 
-    for (block = super_block->inode_start; block < super_block->ba_map_start; block++) {
-        block_read(block, inode_block_buffer);
-        inodes = (inode_t *)inode_block_buffer;
-        for (index = 0; index < (BLOCK_SIZE / sizeof(inode_t)); index++) {
-            if (inodes[index].type == TYPE_FREE)
-                return (block - super_block->inode_start) * (BLOCK_SIZE / sizeof(inode_t)) + index;
+// read the placed map blocks from disk and count what they have free
+static void map_load(alloc_map_t *map) {
+    int i, j;
+
+    map->free = 0;
+    for (i = 0; i < map->count; i++) {
+        bcache_read(map->where[i], (char *)&map->words[i * MAP_WORDS_PER_BLOCK]);
+        map->dirty[i] = FALSE;
+        map_mark_tail(map, i);
+        map->group_free[i] = 0;
+        for (j = i * MAP_WORDS_PER_BLOCK; j < (i + 1) * MAP_WORDS_PER_BLOCK; j++) {
+            map->group_free[i] += 32 - bit_count(map->words[j]);
         }
+        map->free += map->group_free[i];
     }
-
-    return -1;
 }
 
-// read from disk inode with index inode_num
-inode_t *inode_read(char *block_buffer, int inode_num, super_block_t *super_block) {
-    inode_t *inodes;
+// write back the map blocks that changed since the last flush
+static void map_flush(alloc_map_t *map) {
     int i;
-    int block_num = inode_num / (BLOCK_SIZE / sizeof(inode_t)) + super_block->inode_start;
+    for (i = 0; i < map->count; i++) {
+        if (map->dirty[i]) {
+            bcache_write(map->where[i], (char *)&map->words[i * MAP_WORDS_PER_BLOCK]);
+            map->dirty[i] = FALSE;
+        }
+    }
+}
 
-    if (inode_num >= super_block->max_num_inodes) { return NULL; }
+// take a free object from block group of the map 32 at a time, starting from where the last one
+// was found if that was in the same block
+static int map_alloc(alloc_map_t *map, int group) {
+    int i, word, bit;
+    int first = group * MAP_WORDS_PER_BLOCK;
+    int start = 0;
 
-    block_read(block_num, block_buffer);
-    inodes = (inode_t *)block_buffer;
-    i = inode_num % (BLOCK_SIZE / sizeof(inode_t));
-    return &inodes[i];
+    if (map->group_free[group] == 0) { return -1; }
+    if (map->hint >= first && map->hint < first + MAP_WORDS_PER_BLOCK)
+        start = map->hint - first;
+
+    // wrap around at most once
+    for (i = 0; i < MAP_WORDS_PER_BLOCK; i++) {
+        word = first + (start + i) % MAP_WORDS_PER_BLOCK;
+        if (map->words[word] != 0xffffffff) {
+            bit = __builtin_ctz(~map->words[word]); // find first zero bit
+            map_set(map, word * 32 + bit);
+            map->hint = word;
+            return word * 32 + bit;
+        }
+    }
+
+    return -1;
 }
 
-// write to disk inode with index inode_num
-void inode_write(char *block_buffer, int inode_num, super_block_t *super_block) {
-    ASSERT(inode_num < super_block->max_num_inodes);
-    int block_num = inode_num / (BLOCK_SIZE / sizeof(inode_t)) + super_block->inode_start;
-    block_write(block_num, block_buffer);
+// take up to count free objects in a row starting exactly at index, return how many were taken
+static int map_alloc_at(alloc_map_t *map, int index, int count) {
+    int n = 0;
+    while (n < count && index + n < map->count * MAP_BITS_PER_BLOCK && !map_test(map, index + n)) {
+        map_set(map, index + n);
+        n++;
+    }
+    return n;
 }
 
-// free inode with index inode_num
-void inode_free(int inode_num, super_block_t *super_block) {
-    int i;
-    char inode_block_buffer[BLOCK_SIZE];
-    inode_t *inode;
+// take count free objects at or after object goal from the first run that has room more free
+// after them, or from the longest shorter run if there is none; return the first object taken and
+// store how many were taken in *got. with room set a run that does not start at goal also keeps
+// room free objects at its start, for whatever is in use before it to grow into
+static int map_alloc_run(alloc_map_t *map, int goal, int count, int room, int *got) {
+    int num_bits = map->count * MAP_BITS_PER_BLOCK;
+    int i, bit;
+    int lead;
+    int run_start = 0;
+    int run_length = 0;
+    int best_start = -1;
+    int best_length = 0;
 
-    if (inode_num >= super_block->max_num_inodes) { return; }
+    if (map->free == 0) { return -1; }
 
-    inode = inode_read(inode_block_buffer, inode_num, super_block);
-    inode->type = TYPE_FREE;
-    for (i = 0; i < inode->in_use_blocks; i++) {
-        data_free(inode->direct_blocks[i], super_block);
+    // wrap around at most once, runs do not wrap
+    for (i = 0; i < num_bits && best_length < count + room; i++) {
+        bit = (goal + i) % num_bits;
+        if (bit == 0)
+            run_length = 0;
+        // skip words with no free objects 32 at a time
+        if (bit % 32 == 0 && map->words[bit / 32] == 0xffffffff) {
+            run_length = 0;
+            i += 31;
+            continue;
+        }
+        if (map_test(map, bit)) {
+            run_length = 0;
+            continue;
+        }
+        if (run_length == 0)
+            run_start = bit;
+        run_length++;
+        lead = (run_start == goal) ? 0 : room;
+        if (run_length - lead > best_length) {
+            best_start = run_start + lead;
+            best_length = run_length - lead;
+        }
     }
-    inode_write(inode_block_buffer, inode_num, super_block);
+
+    // every run is too short to keep room free at its start
+    if (best_start == -1 && room > 0) { return map_alloc_run(map, goal, count, 0, got); }
+    if (best_start == -1) { return -1; }
+    *got = map_alloc_at(map, best_start, (best_length < count) ? best_length : count);
+    return best_start;
 }
 
-// DIRECTORY STUFF
-static void str_copy(char *src, char *dest) {
-    bcopy((unsigned char *)src, (unsigned char *)dest, strlen(src) + 1);
+// the reference count table stays resident as well, one byte per block
+typedef struct {
+    uint8_t counts[REF_MAX_BLOCKS * BLOCK_SIZE]; // owners of each block besides the first
+    bool_t dirty[REF_MAX_BLOCKS]; // table blocks changed since the last flush
+    int start; // first block of the table on disk
+    int count; // number of blocks of the table on disk
+    int shared; // number of blocks with a count above 0
+} ref_table_t;
+
+static ref_table_t ref_table;
+
+// add an owner to block
+static void ref_get(int block) {
+    if (ref_table.counts[block] == 0)
+        ref_table.shared++;
+    ref_table.counts[block]++;
+    ref_table.dirty[block / BLOCK_SIZE] = TRUE;
 }
 
-// read a directory entry
-static directory_entry_t *directory_read(char *block_buffer, int data_block_num, int data_block_offset) {
-    directory_entry_t *directory_entries;
-    block_read(data_block_num, block_buffer);
-    directory_entries = (directory_entry_t *)block_buffer;
-    return &directory_entries[data_block_offset];
+// drop an owner of block, return FALSE if it had only the one
+static bool_t ref_put(int block) {
+    if (ref_table.counts[block] == 0) { return FALSE; }
+    ref_table.counts[block]--;
+    if (ref_table.counts[block] == 0)
+        ref_table.shared--;
+    ref_table.dirty[block / BLOCK_SIZE] = TRUE;
+    return TRUE;
 }
 
-// write a directory entry
-static void directory_write(char *block_buffer, int data_block_num) {
-    block_write(data_block_num, block_buffer);
+// set the owners of block besides the first to count
+static void ref_set(int block, int count) {
+    if (ref_table.counts[block] == 0 && count > 0)
+        ref_table.shared++;
+    else if (ref_table.counts[block] > 0 && count == 0)
+        ref_table.shared--;
+    ref_table.counts[block] = count;
+    ref_table.dirty[block / BLOCK_SIZE] = TRUE;
 }
 
-// add a file inode to a directory
-int dir_add(char *name, int dir_inode_num, int file_inode_num, super_block_t *super_block) {
-    inode_t *dir_inode;
-    directory_entry_t *directory_entry;
-    int current_num_entries;
-    int max_num_entries;
-    int data_block_index;
-    int data_block_offset;
-    int data_new_block;
-    char inode_block_buffer[BLOCK_SIZE];
-    char data_block_buffer[BLOCK_SIZE];
+// the group descriptors stay resident too. the free counts on disk follow the maps, they are
+// brought up to date whenever the maps are written back
+typedef struct {
+    group_desc_t descs[GROUP_TABLE_MAX_BLOCKS * GROUP_DESCS_PER_BLOCK];
+    bool_t dirty[GROUP_TABLE_MAX_BLOCKS]; // table blocks changed since the last flush
+    int start; // first block of the table on disk
+    int count; // number of blocks of the table on disk
+    int groups; // number of groups in use
+} group_table_t;
 
-    dir_inode = inode_read(inode_block_buffer, dir_inode_num, super_block);
-    current_num_entries = dir_inode->size / sizeof(directory_entry_t);
-    max_num_entries = (BLOCK_SIZE / sizeof(directory_entry_t)) * DATA_BLOCK_NUM;
+static group_table_t group_table;
 
-    // check if dir_inode is full and return -1 if full
-    if (current_num_entries >= max_num_entries) {
-        return -1;
+// data blocks freed by the running operation. they go back to the block allocation map together
+// when it ends, so an operation never hands out a block it freed itself
+static uint32_t freed_words[MAP_WORDS];
+static bool_t freed_groups[MAP_MAX_BLOCKS]; // groups with blocks in freed_words
+
+// bit of the inode allocation map for inode inode_num
+static int ino_bit(int inode_num, super_block_t *super_block) {
+    return inode_num / super_block->group_inodes * MAP_BITS_PER_BLOCK + inode_num % super_block->group_inodes;
+}
+
+// place the blocks of both maps in the groups the descriptors describe
+static void map_place_groups(void) {
+    group_desc_t *desc;
+    int i;
+
+    map_init(&ba_map, group_table.groups);
+    map_init(&ino_map, group_table.groups);
+    bzero((char *)freed_words, sizeof(freed_words));
+    bzero((char *)freed_groups, sizeof(freed_groups));
+    for (i = 0; i < group_table.groups; i++) {
+        desc = &group_table.descs[i];
+        map_place(&ba_map, i, desc->block_map, desc->data_start + desc->data_count - i * GROUP_BLOCKS);
+        map_place(&ino_map, i, desc->inode_map, desc->inodes);
     }
+}
 
-    // calculate the next available entry in the directory
-    data_block_index = current_num_entries / (BLOCK_SIZE / sizeof(directory_entry_t));
-    data_block_offset = current_num_entries % (BLOCK_SIZE / sizeof(directory_entry_t));
+// build the maps for a freshly made file system: only the metadata blocks and the root inode are in use
+void alloc_map_init(super_block_t *super_block) {
+    int i, j;
 
-    // allocate a new data block if necessary
-    if (data_block_offset == 0) {
-        data_new_block = get_free_data(super_block);
-        // if no free blocks return -1
-        if (data_new_block == -1)
-            return -1;
-        dir_inode->in_use_blocks++;
-        dir_inode->direct_blocks[data_block_index] = data_new_block;
-        // add 2 to padding if it's not the first block
-        if (data_block_index != 0)
-            dir_inode->size += 2;
+    bzero((char *)&group_table, sizeof(group_table));
+    group_table.start = super_block->group_table_start;
+    group_table.count = super_block->group_table_count;
+    group_table.groups = super_block->group_count;
+    for (i = 0; i < group_table.groups; i++) {
+        group_layout(&group_table.descs[i], i, super_block);
+    }
+    map_place_groups();
+    for (i = 0; i < group_table.groups; i++) {
+        for (j = i * GROUP_BLOCKS; j < group_table.descs[i].data_start; j++) {
+            map_set(&ba_map, j);
+        }
     }
+    ba_map.hint = group_table.descs[0].data_start / 32;
+    map_set(&ino_map, ino_bit(ROOT_DIRECTORY, super_block));
+    // mkfs zeroed the reference count table on disk, no block is shared
+    bzero((char *)&ref_table, sizeof(ref_table));
+    ref_table.start = super_block->ref_table_start;
+    ref_table.count = super_block->ref_table_count;
+    alloc_map_flush(super_block);
+}
 
-    // add file to data block
-    directory_entry = directory_read(data_block_buffer, dir_inode->direct_blocks[data_block_index], data_block_offset);
-    directory_entry->inode = file_inode_num;
-    str_copy(name, directory_entry->name);
-    directory_write(data_block_buffer, dir_inode->direct_blocks[data_block_index]);
+// read the group descriptors, both allocation maps and the reference count table into memory
+void alloc_map_load(super_block_t *super_block) {
+    int i;
 
-    dir_inode->size += sizeof(directory_entry_t);
-    inode_write(inode_block_buffer, dir_inode_num, super_block);
+    ASSERT(super_block->group_table_count <= GROUP_TABLE_MAX_BLOCKS);
+    bzero((char *)&group_table, sizeof(group_table));
+    group_table.start = super_block->group_table_start;
+    group_table.count = super_block->group_table_count;
+    group_table.groups = super_block->group_count;
+    for (i = 0; i < group_table.count; i++) {
+        bcache_read(group_table.start + i, (char *)&group_table.descs[i * GROUP_DESCS_PER_BLOCK]);
+    }
+    map_place_groups();
+    map_load(&ba_map);
+    map_load(&ino_map);
+    ba_map.hint = group_table.descs[0].data_start / 32;
 
-    return 0;
+    ASSERT(super_block->ref_table_count <= REF_MAX_BLOCKS);
+    bzero((char *)&ref_table, sizeof(ref_table));
+    ref_table.start = super_block->ref_table_start;
+    ref_table.count = super_block->ref_table_count;
+    for (i = 0; i < ref_table.count; i++) {
+        bcache_read(ref_table.start + i, (char *)&ref_table.counts[i * BLOCK_SIZE]);
+    }
+    for (i = 0; i < super_block->fs_size; i++) {
+        if (ref_table.counts[i] > 0)
+            ref_table.shared++;
+    }
 }
 
-// remove a file from a directory
-int dir_remove(int dir_inode_num, char *name, super_block_t *super_block) {
-    inode_t *dir_inode;
-    directory_entry_t *directory_entry;
-    directory_entry_t *last_entry;
-    int current_num_entries;
-    int data_block_index;
-    int data_block_offset;
-    int data_block_num;
-    int max_index;
+// return the blocks freed by the operation that just ended to the block allocation map, a word
+// of the map at a time
+static void data_free_release(void) {
+    int i, j, n;
+
+    for (i = 0; i < ba_map.count; i++) {
+        if (!freed_groups[i]) { continue; }
+        for (j = i * MAP_WORDS_PER_BLOCK; j < (i + 1) * MAP_WORDS_PER_BLOCK; j++) {
+            if (freed_words[j] == 0) { continue; }
+            n = bit_count(freed_words[j]);
+            ba_map.words[j] &= ~freed_words[j];
+            ba_map.group_free[i] += n;
+            ba_map.free += n;
+            freed_words[j] = 0;
+        }
+        ba_map.dirty[i] = TRUE;
+        freed_groups[i] = FALSE;
+    }
+}
+
+// write back the allocation map, group descriptor and reference count blocks that changed since
+// the last flush. this is the end of an operation, so the blocks it freed become free here
+void alloc_map_flush(super_block_t *super_block) {
+    group_desc_t *desc;
     int i;
-    uint16_t last_block_index;
-    int last_block_offset;
-    char inode_block_buffer[BLOCK_SIZE];
-    char data_block_buffer[BLOCK_SIZE];
-    char last_block_buffer[BLOCK_SIZE];
 
-    dir_inode = inode_read(inode_block_buffer, dir_inode_num, super_block);
-    current_num_entries = dir_inode->size / sizeof(directory_entry_t);
-    data_block_offset = current_num_entries % (BLOCK_SIZE / sizeof(directory_entry_t));
+    data_free_release();
+    for (i = 0; i < group_table.groups; i++) {
+        desc = &group_table.descs[i];
+        if (desc->free_blocks != ba_map.group_free[i] || desc->free_inodes != ino_map.group_free[i]) {
+            desc->free_blocks = ba_map.group_free[i];
+            desc->free_inodes = ino_map.group_free[i];
+            group_table.dirty[i / GROUP_DESCS_PER_BLOCK] = TRUE;
+        }
+    }
+    map_flush(&ba_map);
+    map_flush(&ino_map);
+    for (i = 0; i < group_table.count; i++) {
+        if (group_table.dirty[i]) {
+            bcache_write(group_table.start + i, (char *)&group_table.descs[i * GROUP_DESCS_PER_BLOCK]);
+            group_table.dirty[i] = FALSE;
+        }
+    }
+    for (i = 0; i < ref_table.count; i++) {
+        if (ref_table.dirty[i]) {
+            bcache_write(ref_table.start + i, (char *)&ref_table.counts[i * BLOCK_SIZE]);
+            ref_table.dirty[i] = FALSE;
+        }
+    }
+}
 
-    // loop through data blocks to find the entry and remove it
-    for (data_block_index = 0; data_block_index < dir_inode->in_use_blocks; data_block_index++) {
-        data_block_num = dir_inode->direct_blocks[data_block_index];
-        block_read(data_block_num, data_block_buffer);
-        directory_entry = (directory_entry_t *)data_block_buffer;
-        if (data_block_index == (dir_inode->in_use_blocks - 1) && data_block_offset != 0)
-            max_index = data_block_offset;
-        else
-            max_index = BLOCK_SIZE / sizeof(directory_entry_t);
-        for (i = 0; i < max_index; i++) {
-            if (same_string(name, directory_entry[i].name)) {
-                dir_inode->size -= sizeof(directory_entry_t);
-                // if this is the only entry in directory, free the block, write back inode, and return
-                if (dir_inode->size == 0) {
-                    data_free(data_block_num, super_block);
-                    inode_write(inode_block_buffer, dir_inode_num, super_block);
-                    return 0;
-                }
-                // find last entry and copy into entry being replaced
-                last_block_index = dir_inode->in_use_blocks - 1;
-                if (data_block_offset == 0) {
-                    last_block_offset = BLOCK_SIZE / sizeof(directory_entry_t) - 1;
-                }
-                else {
-                    last_block_offset = data_block_offset - 1;
-                }
-                last_entry = directory_read(last_block_buffer, dir_inode->direct_blocks[last_block_index], last_block_offset);
-                directory_entry[i].inode = last_entry->inode;
-                str_copy(last_entry->name, directory_entry[i].name);
+// TRUE if block is a data block, the metadata of its group comes before the first one
+bool_t block_is_data(int block, super_block_t *super_block) {
+    group_desc_t desc;
 
-                // write back to block
-                block_write(data_block_num, data_block_buffer);
+    if (block < 0 || block >= super_block->fs_size) { return FALSE; }
+    group_layout(&desc, block / GROUP_BLOCKS, super_block);
+    return block >= desc.data_start;
+}
 
-                // free last block if necessary
-                if (last_block_offset == 0) {
-                    data_free(dir_inode->direct_blocks[last_block_index], super_block);
-                    dir_inode->in_use_blocks--;
-                    dir_inode->size -= 2;
-                }
+// DATA BLOCK STUFF
 
-                inode_write(inode_block_buffer, dir_inode_num, super_block);
+// find a run of count free data blocks, starting the search at block goal and settling for the
+// longest shorter run when the disk is too fragmented. without a goal the search carries on
+// where the last one ended. with room set the run has to be followed by that many more free
+// blocks, so a file that keeps growing can extend it in place. return its first block and store
+// its length in *got, otherwise -1
+static int get_free_data_run(int goal, int count, int room, int *got, super_block_t *super_block) {
+    int start;
 
-                return 0;
-            }
-        }
+    if (goal <= 0 || goal >= super_block->fs_size)
+        goal = ba_map.hint * 32;
+    start = map_alloc_run(&ba_map, goal, count, room, got);
+    if (start != -1)
+        ba_map.hint = (start + *got) / 32;
+    return start;
+}
+
+// find a free data block as close after block goal as possible, 0 for no goal
+int get_free_data(int goal, super_block_t *super_block) {
+    int got;
+    return get_free_data_run(goal, 1, 0, &got, super_block);
+}
+
+// take up to count free data blocks in a row starting at data_block, return how many were taken
+static int get_free_data_at(int data_block, int count, super_block_t *super_block) {
+    return map_alloc_at(&ba_map, data_block, count);
+}
+
+// free a data block; its bit in the block allocation map is cleared when the operation ends. a
+// block shared with a clone only loses this owner and keeps its contents. the contents of a freed
+// block are never written, whoever gets the block next initializes it before it can be read
+void data_free(int data_block, super_block_t *super_block) {
+    if (!block_is_data(data_block, super_block)) { return; }
+    if (ref_put(data_block)) { return; }
+    // drop the cached copy, and keep replay from writing an old logged copy over its next use
+    bcache_discard(data_block);
+    journal_forget(data_block);
+    if (map_test(&ba_map, data_block)) {
+        freed_words[data_block / 32] |= ((uint32_t) 1 << (data_block % 32));
+        freed_groups[data_block / MAP_BITS_PER_BLOCK] = TRUE;
     }
+}
 
-    return -1;
+// number of blocks the block allocation map has free
+int data_free_count(void) {
+    return ba_map.free;
 }
 
-// return the inode of the file we are looking for
-int dir_find(int dir_inode_num, char *name, super_block_t *super_block) {
-    inode_t *dir_inode;
-    directory_entry_t *directory_entry;
-    char inode_block_buffer[BLOCK_SIZE];
-    char data_block_buffer[BLOCK_SIZE];
-    int i, j;
-    int current_num_entries;
-    int data_block_offset;
-    int max_index;
+// return how many of the count blocks starting at data_block belong to a single file, stopping
+// at the first one shared with a clone
+int data_private_run(int data_block, int count) {
+    int n;
 
-    dir_inode = inode_read(inode_block_buffer, dir_inode_num, super_block);
-    current_num_entries = dir_inode->size / sizeof(directory_entry_t);
-    data_block_offset = current_num_entries % (BLOCK_SIZE / sizeof(directory_entry_t));
+    if (ref_table.shared == 0) { return count; }
+    n = 0;
+    while (n < count && ref_table.counts[data_block + n] == 0) { n++; }
+    return n;
+}
 
-    for (i = 0; i < dir_inode->in_use_blocks; i++) {
-        block_read(dir_inode->direct_blocks[i], data_block_buffer);
-        directory_entry = (directory_entry_t *)data_block_buffer;
-        if (i == (dir_inode->in_use_blocks - 1) && data_block_offset != 0)
-            max_index = data_block_offset;
-        else
-            max_index = BLOCK_SIZE / sizeof(directory_entry_t);
-        for (j = 0; j < max_index; j++) {
-            if (same_string(name, directory_entry[j].name)) {
-                return directory_entry[j].inode;
-            }
-        }
+// number of blocks shared by more than one file
+int data_shared_count(void) {
+    return ref_table.shared;
+}
+
+// free count data blocks starting at data_block
+static void data_free_run(int data_block, int count, super_block_t *super_block) {
+    int i;
+    for (i = 0; i < count; i++) {
+        data_free(data_block + i, super_block);
     }
+}
 
-    return -1;
+// INODE STUFF
+
+// initialize a new inode
+void inode_init(inode_t *inode, int type) {
+    bzero((char *)inode, sizeof(inode_t));
+    inode->links = 1;
+    inode->type = type;
 }
 
-// FILE DESCRIPTOR STUFF
+// the group for a new directory: of the groups with at least the average number of free inodes,
+// the one with the most free blocks, or with as many and more free inodes. directories spread
+// over the groups this way, and their files are kept with them
+static int dir_group(void) {
+    int average = ino_map.free / group_table.groups;
+    int best = 0;
+    int i;
+
+    for (i = 1; i < group_table.groups; i++) {
+        if (ino_map.group_free[i] < average) { continue; }
+        if (ino_map.group_free[best] < average || ba_map.group_free[i] > ba_map.group_free[best] ||
+            (ba_map.group_free[i] == ba_map.group_free[best] && ino_map.group_free[i] > ino_map.group_free[best]))
+            best = i;
+    }
+    return best;
+}
 
-// open a file descriptor with the given inode and permissions
-int fd_open(file_t *fd_table, int inode, int permissions, int directory) {
+// take a free inode for a new inode of type in directory dir_inode_num and return its index,
+// otherwise return -1. a file gets one in the group of its directory, a directory in the group
+// dir_group picks; when that group is full the groups after it are tried
+int get_free_inode(int dir_inode_num, int type, super_block_t *super_block) {
+    int group;
+    int bit;
     int i;
-    for (i = 0; i < MAX_FILE_DESCRIPTORS; i++) {
-        if (fd_table[i].open == FALSE) {
-            fd_table[i].open = TRUE;
-            fd_table[i].permissions = permissions;
-            fd_table[i].inode = inode;
-            fd_table[i].directory = directory;
-            fd_table[i].position = 0;
-            return i;
-        }
+
+    group = (type == TYPE_DIRECTORY) ? dir_group() : dir_inode_num / super_block->group_inodes;
+    for (i = 0; i < group_table.groups; i++) {
+        bit = map_alloc(&ino_map, (group + i) % group_table.groups);
+        if (bit != -1) { return bit / MAP_BITS_PER_BLOCK * super_block->group_inodes + bit % MAP_BITS_PER_BLOCK; }
     }
     return -1;
 }
 
-// close a file descriptor with the given index
-void fd_close(file_t *fd_table, int fd_index) {
-    fd_table[fd_index].open = FALSE;
+// number of inodes the inode allocation map has free
+int inode_free_count(void) {
+    return ino_map.free;
+}
+
+// the data block that takes the same place in the data blocks of its group as inode inode_num does
+// in the group's inode table. the blocks of a directory are kept near its home, so directories made
+// one after the other sit together and apart from the ones made long before
+static int inode_home(int inode_num, super_block_t *super_block) {
+    group_desc_t *desc = &group_table.descs[inode_num / super_block->group_inodes];
+    return desc->data_start + (uint32_t) (inode_num % super_block->group_inodes) * desc->data_count / desc->inodes;
 }
 
-// search in fd_table for files with the specific directory
-int fd_dir_search(file_t *fd_table, int directory) {
+// where to look for blocks for a new file of directory dir_vnode: after the first block of the
+// directory, or before it has one, at the home of the directory
+int dir_goal(vnode_t *dir_vnode, super_block_t *super_block) {
+    int block = inode_bmap(&dir_vnode->inode, 0, super_block);
+    if (block == 0) { return inode_home(dir_vnode->inode_num, super_block); }
+    return block + 1;
+}
+
+// disk block holding inode inode_num, which is in the slice of the inode table of its group
+static int inode_block(int inode_num, super_block_t *super_block) {
+    group_desc_t *desc = &group_table.descs[inode_num / super_block->group_inodes];
+    return desc->inode_table + inode_num % super_block->group_inodes / INODES_PER_BLOCK(super_block);
+}
+
+// read from disk inode with index inode_num. only its first inode_size bytes are in the block
+static inode_t *inode_read(char *block_buffer, int inode_num, super_block_t *super_block) {
     int i;
-    for (i = 0; i < MAX_FILE_DESCRIPTORS; i++) {
-        if (fd_table[i].open == TRUE && fd_table[i].directory == directory) {
-            return 0;
-        }
+
+    if (inode_num >= super_block->max_num_inodes) { return NULL; }
+
+    bcache_read(inode_block(inode_num, super_block), block_buffer);
+    i = inode_num % super_block->group_inodes % INODES_PER_BLOCK(super_block);
+    return (inode_t *)&block_buffer[i * super_block->inode_size];
+}
+
+// write to disk inode with index inode_num
+static void inode_write(char *block_buffer, int inode_num, super_block_t *super_block) {
+    ASSERT(inode_num < super_block->max_num_inodes);
+    bcache_write(inode_block(inode_num, super_block), block_buffer);
+}
+
+// BLOCK MAP STUFF
+
+// point *ptrs at the block pointers for file blocks index onwards and return how many
+// of them live in the same pointer block, 0 if index is not mapped
+static int bmap_ptrs(inode_t *inode, int index, uint32_t *buffer, uint32_t **ptrs) {
+    int indirect;
+
+    if (index < DATA_BLOCK_NUM) {
+        *ptrs = &inode->direct_blocks[index];
+        return DATA_BLOCK_NUM - index;
     }
-    return -1;
-}
\ No newline at end of file
+    index -= DATA_BLOCK_NUM;
+
+    if (index < PTRS_PER_BLOCK) {
+        indirect = inode->indirect_block;
+    }
+    else {
+        index -= PTRS_PER_BLOCK;
+        if (index >= PTRS_PER_BLOCK * PTRS_PER_BLOCK) { return 0; }
+        if (inode->double_indirect_block == 0) { return 0; }
+        bcache_read(inode->double_indirect_block, (char *)buffer);
+        indirect = buffer[index / PTRS_PER_BLOCK];
+        index %= PTRS_PER_BLOCK;
+    }
+    if (indirect == 0) { return 0; }
+
+    bcache_read(indirect, (char *)buffer);
+    *ptrs = &buffer[index];
+    return PTRS_PER_BLOCK - index;
+}
+
+// make sure *slot points at a pointer block, allocating a zeroed one if it does not. it goes near
+// goal, but past the room the data before it may grow into
+static int ptr_block_alloc(uint32_t *slot, int goal, super_block_t *super_block) {
+    char zero_block[BLOCK_SIZE];
+    int block;
+    int got;
+
+    if (*slot != 0) { return 0; }
+    block = get_free_data_run(goal, 1, ALLOC_ROOM, &got, super_block);
+    if (block == -1) { return -1; }
+    bzero_block(zero_block);
+    bcache_write(block, zero_block);
+    *slot = block;
+    return 0;
+}
+
+// free a pointer block, and at depth 1 the indirect blocks it points to
+static void ptr_block_free(int block, int depth, super_block_t *super_block) {
+    uint32_t ptrs[PTRS_PER_BLOCK];
+    int i;
+
+    if (block == 0) { return; }
+    if (depth > 0) {
+        bcache_read(block, (char *)ptrs);
+        for (i = 0; i < PTRS_PER_BLOCK; i++) {
+            ptr_block_free(ptrs[i], depth - 1, super_block);
+        }
+    }
+    data_free(block, super_block);
+}
+
+// map file block index of a block mapped inode to data_block, allocating indirect blocks next to it
+static int bmap_set(inode_t *inode, int index, int data_block, super_block_t *super_block) {
+    uint32_t ptrs[PTRS_PER_BLOCK];
+    uint32_t indirect;
+
+    if (index < DATA_BLOCK_NUM) {
+        inode->direct_blocks[index] = data_block;
+        return 0;
+    }
+    index -= DATA_BLOCK_NUM;
+
+    if (index < PTRS_PER_BLOCK) {
+        if (ptr_block_alloc(&inode->indirect_block, data_block, super_block) == -1) { return -1; }
+        indirect = inode->indirect_block;
+    }
+    else {
+        index -= PTRS_PER_BLOCK;
+        if (index >= PTRS_PER_BLOCK * PTRS_PER_BLOCK) { return -1; }
+        if (ptr_block_alloc(&inode->double_indirect_block, data_block, super_block) == -1) { return -1; }
+        bcache_read(inode->double_indirect_block, (char *)ptrs);
+        indirect = ptrs[index / PTRS_PER_BLOCK];
+        if (indirect == 0) {
+            if (ptr_block_alloc(&indirect, data_block, super_block) == -1) { return -1; }
+            ptrs[index / PTRS_PER_BLOCK] = indirect;
+            bcache_write(inode->double_indirect_block, (char *)ptrs);
+        }
+        index %= PTRS_PER_BLOCK;
+    }
+
+    bcache_read(indirect, (char *)ptrs);
+    ptrs[index] = data_block;
+    bcache_write(indirect, (char *)ptrs);
+    return 0;
+}
+
+// clear the pointers of pointer block block from index first on and free the data blocks
+// they point to, ptrs is scratch space; return how many were freed
+static int ptr_block_clear(int block, int first, uint32_t *ptrs, super_block_t *super_block) {
+    int freed = 0;
+    int i;
+
+    if (block == 0) { return 0; }
+    bcache_read(block, (char *)ptrs);
+    for (i = first; i < PTRS_PER_BLOCK; i++) {
+        if (ptrs[i] == 0) { continue; }
+        data_free(ptrs[i], super_block);
+        ptrs[i] = 0;
+        freed++;
+    }
+    if (freed > 0)
+        bcache_write(block, (char *)ptrs);
+    return freed;
+}
+
+// free the data blocks of a block mapped file past its first num_blocks blocks and clear their
+// pointers, so that those blocks read as holes if the file grows past them again. return how
+// many were freed; indirect blocks are kept until the inode itself is freed
+static int bmap_truncate(inode_t *inode, int num_blocks, super_block_t *super_block) {
+    uint32_t ptrs[PTRS_PER_BLOCK];
+    int per_block = PTRS_PER_BLOCK;
+    int freed = 0;
+    int first;
+    int i;
+
+    for (i = num_blocks; i < DATA_BLOCK_NUM; i++) {
+        if (inode->direct_blocks[i] == 0) { continue; }
+        data_free(inode->direct_blocks[i], super_block);
+        inode->direct_blocks[i] = 0;
+        freed++;
+    }
+
+    first = num_blocks - DATA_BLOCK_NUM;
+    if (first < 0)
+        first = 0;
+    if (first < per_block)
+        freed += ptr_block_clear(inode->indirect_block, first, ptrs, super_block);
+
+    first -= per_block;
+    if (first < 0)
+        first = 0;
+    if (inode->double_indirect_block == 0) { return freed; }
+    for (i = first / per_block; i < per_block; i++) {
+        bcache_read(inode->double_indirect_block, (char *)ptrs);
+        freed += ptr_block_clear(ptrs[i], (i == first / per_block) ? first % per_block : 0, ptrs, super_block);
+    }
+    return freed;
+}
+
+// return extent i of an extent mapped inode, more holds the overflow block if there is one
+static extent_t *extent_at(inode_t *inode, extent_t *more, int i) {
+    if (i < INODE_EXTENTS)
+        return &inode->extents[i];
+    return &more[i - INODE_EXTENTS];
+}
+
+// read the overflow extents of inode into buffer, return NULL if it has none
+static extent_t *extent_block_read(inode_t *inode, char *buffer) {
+    if (inode->extent_block == 0) { return NULL; }
+    bcache_read(inode->extent_block, buffer);
+    return (extent_t *)buffer;
+}
+
+// allocate up to count blocks for the unmapped file blocks index onwards of an extent mapped file,
+// stopping short of the next mapped block. the extent ending at index grows in place when the
+// blocks after it are free, otherwise a new extent is inserted with blocks found from goal on
+// that leave room free after them; return how many were allocated
+static int extent_alloc(inode_t *inode, int index, int count, int goal, int room, super_block_t *super_block) {
+    char buffer[BLOCK_SIZE];
+    extent_t *more;
+    extent_t *extent;
+    int start;
+    int pos;
+    int n, i;
+
+    more = extent_block_read(inode, buffer);
+    for (pos = 0; pos < inode->num_extents; pos++) {
+        extent = extent_at(inode, more, pos);
+        if (extent->file_block > index) {
+            if (extent->file_block - index < count)
+                count = extent->file_block - index;
+            break;
+        }
+    }
+
+    if (pos > 0) {
+        extent = extent_at(inode, more, pos - 1);
+        if (extent->file_block + extent->length == index) {
+            n = get_free_data_at(extent->start + extent->length, count, super_block);
+            if (n > 0) {
+                extent->length += n;
+                if (pos - 1 >= INODE_EXTENTS)
+                    bcache_write(inode->extent_block, buffer);
+                return n;
+            }
+        }
+    }
+
+    if (inode->num_extents == MAX_EXTENTS) { return -1; }
+    if (inode->num_extents == INODE_EXTENTS) {
+        if (ptr_block_alloc(&inode->extent_block, goal, super_block) == -1) { return -1; }
+        more = extent_block_read(inode, buffer);
+    }
+    start = get_free_data_run(goal, count, room, &n, super_block);
+    if (start == -1) {
+        if (inode->num_extents == INODE_EXTENTS) {
+            data_free(inode->extent_block, super_block);
+            inode->extent_block = 0;
+        }
+        return -1;
+    }
+
+    // make room for the new extent at pos
+    for (i = inode->num_extents; i > pos; i--) {
+        bcopy((unsigned char *)extent_at(inode, more, i - 1), (unsigned char *)extent_at(inode, more, i), sizeof(extent_t));
+    }
+    extent = extent_at(inode, more, pos);
+    extent->file_block = index;
+    extent->start = start;
+    extent->length = n;
+    inode->num_extents++;
+    if (inode->num_extents > INODE_EXTENTS)
+        bcache_write(inode->extent_block, buffer);
+    return n;
+}
+
+// free the blocks of an extent mapped file past its first num_blocks blocks, return how many were freed
+static int extent_truncate(inode_t *inode, int num_blocks, super_block_t *super_block) {
+    char buffer[BLOCK_SIZE];
+    extent_t *more;
+    extent_t *extent;
+    int keep;
+    int freed = 0;
+
+    more = extent_block_read(inode, buffer);
+    while (inode->num_extents > 0) {
+        extent = extent_at(inode, more, inode->num_extents - 1);
+        if (extent->file_block + extent->length <= num_blocks) { break; }
+        keep = 0;
+        if (extent->file_block < num_blocks)
+            keep = num_blocks - extent->file_block;
+        data_free_run(extent->start + keep, extent->length - keep, super_block);
+        freed += extent->length - keep;
+        extent->length = keep;
+        if (keep > 0) { break; }
+        inode->num_extents--;
+    }
+    if (more != NULL && inode->num_extents > INODE_EXTENTS) {
+        bcache_write(inode->extent_block, buffer);
+    }
+    else if (more != NULL) {
+        data_free(inode->extent_block, super_block);
+        inode->extent_block = 0;
+    }
+    return freed;
+}
+
+// unmap file block index of an extent mapped file and drop its owner of the block it was mapped
+// to. an extent the block is in the middle of is split in two; return -1 if there is no room for
+// another extent, otherwise 0
+static int extent_punch(inode_t *inode, int index, super_block_t *super_block) {
+    char buffer[BLOCK_SIZE];
+    extent_t *more;
+    extent_t *extent;
+    extent_t *tail;
+    int block;
+    int pos, i;
+
+    more = extent_block_read(inode, buffer);
+    for (pos = 0; pos < inode->num_extents; pos++) {
+        extent = extent_at(inode, more, pos);
+        if (extent->file_block <= index && index < extent->file_block + extent->length) { break; }
+    }
+    if (pos == inode->num_extents) { return -1; }
+    block = extent->start + (index - extent->file_block);
+
+    if (extent->length == 1) {
+        for (i = pos; i < inode->num_extents - 1; i++) {
+            bcopy((unsigned char *)extent_at(inode, more, i + 1), (unsigned char *)extent_at(inode, more, i), sizeof(extent_t));
+        }
+        inode->num_extents--;
+    }
+    else if (index == extent->file_block) {
+        extent->file_block++;
+        extent->start++;
+        extent->length--;
+    }
+    else if (index == extent->file_block + extent->length - 1) {
+        extent->length--;
+    }
+    else {
+        if (inode->num_extents == MAX_EXTENTS) { return -1; }
+        if (inode->num_extents == INODE_EXTENTS) {
+            if (ptr_block_alloc(&inode->extent_block, block, super_block) == -1) { return -1; }
+            more = extent_block_read(inode, buffer);
+        }
+        // make room for the tail at pos + 1
+        for (i = inode->num_extents; i > pos + 1; i--) {
+            bcopy((unsigned char *)extent_at(inode, more, i - 1), (unsigned char *)extent_at(inode, more, i), sizeof(extent_t));
+        }
+        tail = extent_at(inode, more, pos + 1);
+        tail->file_block = index + 1;
+        tail->start = block + 1;
+        tail->length = extent->file_block + extent->length - (index + 1);
+        extent->length = index - extent->file_block;
+        inode->num_extents++;
+    }
+    if (more != NULL)
+        bcache_write(inode->extent_block, buffer);
+    data_free(block, super_block);
+    return 0;
+}
+
+// fill runs with at most max_runs mappings of consecutive file blocks, the first one starting
+// at index and none going past file block limit; return the number of runs filled
+static int map_fill(inode_t *inode, int index, int limit, extent_t *runs, int max_runs) {
+    char buffer[BLOCK_SIZE];
+    extent_t *more;
+    extent_t *extent;
+    uint32_t *ptrs;
+    int num_runs;
+    int n, i;
+
+    num_runs = 0;
+    // an inline file has no blocks to map
+    if (index >= limit || (inode->flags & INODE_INLINE)) { return 0; }
+
+    if (inode->flags & INODE_EXTENT_MAPPED) {
+        more = extent_block_read(inode, buffer);
+        for (i = 0; i < inode->num_extents && num_runs < max_runs && index < limit; i++) {
+            extent = extent_at(inode, more, i);
+            if (extent->file_block + extent->length <= index) { continue; }
+            // index falls in a hole
+            if (extent->file_block > index) { break; }
+            runs[num_runs].file_block = index;
+            runs[num_runs].start = extent->start + (index - extent->file_block);
+            runs[num_runs].length = extent->file_block + extent->length - index;
+            if (runs[num_runs].length > limit - index)
+                runs[num_runs].length = limit - index;
+            index += runs[num_runs].length;
+            num_runs++;
+        }
+        return num_runs;
+    }
+
+    // block pointers that follow each other on disk are merged into one run
+    n = bmap_ptrs(inode, index, (uint32_t *)buffer, &ptrs);
+    if (n > limit - index) { n = limit - index; }
+    for (i = 0; i < n && ptrs[i] != 0; i++) {
+        if (num_runs > 0 && ptrs[i] == runs[num_runs - 1].start + runs[num_runs - 1].length) {
+            runs[num_runs - 1].length++;
+            continue;
+        }
+        if (num_runs == max_runs) { break; }
+        runs[num_runs].file_block = index + i;
+        runs[num_runs].start = ptrs[i];
+        runs[num_runs].length = 1;
+        num_runs++;
+    }
+    return num_runs;
+}
+
+// return the disk block holding file block index of inode, 0 if it is not mapped
+int inode_bmap(inode_t *inode, int index, super_block_t *super_block) {
+    extent_t run;
+    if (map_fill(inode, index, index + 1, &run, 1) == 0) { return 0; }
+    return run.start;
+}
+
+// return the number of runs of consecutive disk blocks the data of inode is stored in, taken in
+// file order, so the average run length shows how fragmented the file is
+int inode_runs(inode_t *inode, super_block_t *super_block) {
+    extent_t runs[FD_MAP_RUNS];
+    int index = 0;
+    int next = 0; // disk block that would continue the last run
+    int count = 0;
+    int n, i;
+
+    while (index < inode->in_use_blocks) {
+        n = map_fill(inode, index, inode->in_use_blocks, runs, FD_MAP_RUNS);
+        // index falls in a hole
+        if (n == 0) {
+            index++;
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            if (runs[i].start != next)
+                count++;
+            next = runs[i].start + runs[i].length;
+        }
+        index = runs[n - 1].file_block + runs[n - 1].length;
+    }
+    return count;
+}
+
+// write the data blocks of inode that are dirty in the cache to their home locations
+void inode_flush(inode_t *inode, super_block_t *super_block) {
+    extent_t runs[FD_MAP_RUNS];
+    int index = 0;
+    int n, i;
+
+    while (index < inode->in_use_blocks) {
+        n = map_fill(inode, index, inode->in_use_blocks, runs, FD_MAP_RUNS);
+        // index falls in a hole
+        if (n == 0) {
+            index++;
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            bcache_flush_range(runs[i].start, runs[i].length);
+        }
+        index = runs[n - 1].file_block + runs[n - 1].length;
+    }
+}
+
+// allocate up to count blocks for the unmapped file blocks index onwards of a file, where index
+// may be in a hole or at or past the end of the mapping. the blocks are looked for right after
+// the one file block index - 1 is mapped to, in a run with ALLOC_ROOM free blocks after it, so a
+// file that grows a little at a time among others keeps growing in place. goal places the blocks
+// when there is no such block, 0 for anywhere. return how many were allocated or -1 if there is
+// no space
+int inode_alloc(inode_t *inode, int index, int count, int goal, super_block_t *super_block) {
+    int new_block;
+    int room = 0;
+    int n;
+
+    ASSERT(!(inode->flags & INODE_INLINE));
+    if (index + count > MAX_FILE_BLOCKS)
+        count = MAX_FILE_BLOCKS - index;
+    if (count <= 0) { return -1; }
+    n = (index > 0) ? inode_bmap(inode, index - 1, super_block) : 0;
+    if (n != 0) {
+        goal = n + 1;
+        room = ALLOC_ROOM;
+    }
+
+    if (inode->flags & INODE_EXTENT_MAPPED) {
+        n = extent_alloc(inode, index, count, goal, room, super_block);
+        if (n == -1) { return -1; }
+    }
+    else {
+        // block mapped files get a block at a time, the one after the last if it is free
+        new_block = goal;
+        if (get_free_data_at(goal, 1, super_block) == 0)
+            new_block = get_free_data_run(goal, 1, room, &n, super_block);
+        if (new_block == -1) { return -1; }
+        if (bmap_set(inode, index, new_block, super_block) == -1) {
+            data_free(new_block, super_block);
+            return -1;
+        }
+        n = 1;
+    }
+
+    inode->allocated_blocks += n;
+    if (inode->in_use_blocks < index + n)
+        inode->in_use_blocks = index + n;
+    return n;
+}
+
+// add up to count blocks to the end of a file, return how many were added or -1 if there is no space
+int inode_grow(inode_t *inode, int count, super_block_t *super_block) {
+    return inode_alloc(inode, inode->in_use_blocks, count, 0, super_block);
+}
+
+// free the data blocks of a file past its first num_blocks blocks
+void inode_truncate(inode_t *inode, int num_blocks, super_block_t *super_block) {
+    if (num_blocks >= inode->in_use_blocks) { return; }
+
+    if (inode->flags & INODE_EXTENT_MAPPED)
+        inode->allocated_blocks -= extent_truncate(inode, num_blocks, super_block);
+    else
+        inode->allocated_blocks -= bmap_truncate(inode, num_blocks, super_block);
+    inode->in_use_blocks = num_blocks;
+}
+
+// move the contents of an inline file or directory out to a data block found from goal on, after
+// which it is mapped like any other. return 0, or -1 if there is no space and the contents stay inline
+int inode_uninline(inode_t *inode, int goal, super_block_t *super_block) {
+    char block_buffer[BLOCK_SIZE];
+
+    bzero_block(block_buffer);
+    bcopy((unsigned char *)inode->inline_data, (unsigned char *)block_buffer, INODE_INLINE_SIZE);
+    bzero(inode->inline_data, INODE_INLINE_SIZE);
+    inode->flags &= ~INODE_INLINE;
+    // an empty file needs no block yet
+    if (inode->size == 0) { return 0; }
+
+    if (inode_alloc(inode, 0, 1, goal, super_block) == -1) {
+        bcopy((unsigned char *)block_buffer, (unsigned char *)inode->inline_data, INODE_INLINE_SIZE);
+        inode->flags |= INODE_INLINE;
+        return -1;
+    }
+    if (inode->type == TYPE_DIRECTORY)
+        bcache_write(inode_bmap(inode, 0, super_block), block_buffer);
+    else
+        bcache_write_data(inode_bmap(inode, 0, super_block), block_buffer);
+    return 0;
+}
+
+// TRUE if some block of inode cannot count another owner
+static bool_t refs_full(inode_t *inode) {
+    extent_t runs[FD_MAP_RUNS];
+    int index = 0;
+    int n, i, j;
+
+    while (index < inode->in_use_blocks) {
+        n = map_fill(inode, index, inode->in_use_blocks, runs, FD_MAP_RUNS);
+        // index falls in a hole
+        if (n == 0) {
+            index++;
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < runs[i].length; j++) {
+                if (ref_table.counts[runs[i].start + j] == REF_MAX) { return TRUE; }
+            }
+        }
+        index = runs[n - 1].file_block + runs[n - 1].length;
+    }
+    return FALSE;
+}
+
+// make dest, a new file, a clone of src. dest gets a copy of the block mapping, but the data blocks
+// are shared and each gains an owner, so the cost follows the size of the mapping and not of the
+// data. return -1 if there is no space or a block cannot count another owner; dest may then
+// hold some of the blocks and has to be freed
+int inode_clone(inode_t *dest, inode_t *src, super_block_t *super_block) {
+    char buffer[BLOCK_SIZE];
+    extent_t runs[FD_MAP_RUNS];
+    int index;
+    int block;
+    int n, i, j;
+
+    if (src->flags & INODE_INLINE) {
+        dest->size = src->size;
+        dest->flags = src->flags & (INODE_EXTENT_MAPPED | INODE_INLINE);
+        bcopy((unsigned char *)src->inline_data, (unsigned char *)dest->inline_data, INODE_INLINE_SIZE);
+        return 0;
+    }
+    // dest stays empty unless every block can take another owner, so freeing it after a
+    // failure only drops the references it really took
+    if (refs_full(src)) { return -1; }
+
+    dest->size = src->size;
+    dest->flags = src->flags & (INODE_EXTENT_MAPPED | INODE_INLINE);
+
+    // an extent mapped file takes its extents as they are
+    if (src->flags & INODE_EXTENT_MAPPED) {
+        if (src->extent_block != 0) {
+            if (ptr_block_alloc(&dest->extent_block, src->extent_block, super_block) == -1) { return -1; }
+            bcache_read(src->extent_block, buffer);
+            bcache_write(dest->extent_block, buffer);
+        }
+        dest->num_extents = src->num_extents;
+        bcopy((unsigned char *)src->extents, (unsigned char *)dest->extents, sizeof(src->extents));
+    }
+    dest->in_use_blocks = src->in_use_blocks;
+
+    // add an owner to every block and map the blocks of a block mapped file one at a time
+    index = 0;
+    while (index < src->in_use_blocks) {
+        n = map_fill(src, index, src->in_use_blocks, runs, FD_MAP_RUNS);
+        // index falls in a hole
+        if (n == 0) {
+            index++;
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < runs[i].length; j++) {
+                block = runs[i].start + j;
+                ref_get(block);
+                if (!(dest->flags & INODE_EXTENT_MAPPED) &&
+                    bmap_set(dest, runs[i].file_block + j, block, super_block) == -1) {
+                    ref_put(block);
+                    return -1;
+                }
+                dest->allocated_blocks++;
+            }
+        }
+        index = runs[n - 1].file_block + runs[n - 1].length;
+    }
+    return 0;
+}
+
+// give file block index of a file a block of its own in place of the one it shares with a clone
+// and return it; the contents are not copied. return -1 if there is no space
+int inode_unshare(inode_t *inode, int index, super_block_t *super_block) {
+    int old_block = inode_bmap(inode, index, super_block);
+    int new_block;
+
+    ASSERT(old_block != 0);
+    if (inode->flags & INODE_EXTENT_MAPPED) {
+        // punching the block out may split its extent and the new block may need an extent of
+        // its own, so once there is room for both the allocation cannot fail
+        if (inode->num_extents + 2 > MAX_EXTENTS || data_free_count() < 2) { return -1; }
+        if (extent_punch(inode, index, super_block) == -1) { return -1; }
+        inode->allocated_blocks--;
+        inode_alloc(inode, index, 1, old_block, super_block);
+        return inode_bmap(inode, index, super_block);
+    }
+
+    new_block = get_free_data(old_block, super_block);
+    if (new_block == -1) { return -1; }
+    // the pointer blocks on the way to index are already there, so this allocates nothing
+    bmap_set(inode, index, new_block, super_block);
+    data_free(old_block, super_block);
+    return new_block;
+}
+
+// free inode with index inode_num
+void inode_free(int inode_num, super_block_t *super_block) {
+    vnode_t *vnode;
+
+    if (inode_num >= super_block->max_num_inodes) { return; }
+
+    vnode = vnode_get(inode_num, super_block);
+    vnode->inode.type = TYPE_FREE;
+    // free the data blocks, then the blocks that mapped them
+    inode_truncate(&vnode->inode, 0, super_block);
+    if (!(vnode->inode.flags & (INODE_EXTENT_MAPPED | INODE_INLINE))) {
+        ptr_block_free(vnode->inode.indirect_block, 0, super_block);
+        ptr_block_free(vnode->inode.double_indirect_block, 1, super_block);
+        vnode->inode.indirect_block = 0;
+        vnode->inode.double_indirect_block = 0;
+    }
+    vnode->map_gen++;
+    vnode_dirty(vnode);
+    vnode_put(vnode, super_block);
+    if (map_test(&ino_map, ino_bit(inode_num, super_block)))
+        map_clear(&ino_map, ino_bit(inode_num, super_block));
+}
+
+// IN-CORE INODE STUFF
+
+static vnode_t vnode_table[VNODE_TABLE_SIZE];
+static vnode_t *vnode_hash[VNODE_HASH_SIZE];
+static vnode_t *vnode_lru_head; // most recently released unreferenced vnode
+static vnode_t *vnode_lru_tail; // first candidate for eviction
+static int vnode_num_dirty; // vnodes with dirty set, each one is an inode block vnode_sync still writes
+
+#define VNODE_HASH(inode_num) ((inode_num) & (VNODE_HASH_SIZE - 1))
+
+// unreferenced vnodes sit on the LRU list until they are reused or evicted
+static void vnode_lru_remove(vnode_t *vnode) {
+    if (vnode->lru_prev != NULL)
+        vnode->lru_prev->lru_next = vnode->lru_next;
+    else
+        vnode_lru_head = vnode->lru_next;
+    if (vnode->lru_next != NULL)
+        vnode->lru_next->lru_prev = vnode->lru_prev;
+    else
+        vnode_lru_tail = vnode->lru_prev;
+}
+
+static void vnode_lru_push_front(vnode_t *vnode) {
+    vnode->lru_prev = NULL;
+    vnode->lru_next = vnode_lru_head;
+    if (vnode_lru_head != NULL)
+        vnode_lru_head->lru_prev = vnode;
+    vnode_lru_head = vnode;
+    if (vnode_lru_tail == NULL)
+        vnode_lru_tail = vnode;
+}
+
+static void vnode_hash_remove(vnode_t *vnode) {
+    vnode_t **link;
+    for (link = &vnode_hash[VNODE_HASH(vnode->inode_num)]; *link != NULL; link = &(*link)->hash_next) {
+        if (*link == vnode) {
+            *link = vnode->hash_next;
+            return;
+        }
+    }
+}
+
+// forget every in-core inode without writing it back, used when the disk is reformatted
+void vnode_init(void) {
+    int i;
+
+    bzero((char *)vnode_hash, sizeof(vnode_hash));
+    vnode_lru_head = NULL;
+    vnode_lru_tail = NULL;
+    for (i = 0; i < VNODE_TABLE_SIZE; i++) {
+        vnode_table[i].inode_num = -1;
+        vnode_table[i].ref_count = 0;
+        vnode_table[i].open_count = 0;
+        vnode_table[i].dir_open_count = 0;
+        vnode_table[i].dirty = FALSE;
+        vnode_table[i].hash_next = NULL;
+        vnode_lru_push_front(&vnode_table[i]);
+    }
+    vnode_num_dirty = 0;
+}
+
+// the in-core inode for inode_num if it is cached, NULL otherwise
+static vnode_t *vnode_find(int inode_num) {
+    vnode_t *vnode;
+    for (vnode = vnode_hash[VNODE_HASH(inode_num)]; vnode != NULL; vnode = vnode->hash_next) {
+        if (vnode->inode_num == inode_num)
+            return vnode;
+    }
+    return NULL;
+}
+
+// get the in-core inode for inode_num, reading it from disk if it is not cached
+vnode_t *vnode_get(int inode_num, super_block_t *super_block) {
+    vnode_t *vnode;
+    inode_t *inode;
+    char block_buffer[BLOCK_SIZE];
+
+    vnode = vnode_find(inode_num);
+    if (vnode == NULL) {
+        // reuse the least recently released vnode nobody holds
+        vnode = vnode_lru_tail;
+        ASSERT(vnode != NULL);
+        vnode_write(vnode, super_block);
+        if (vnode->inode_num != -1)
+            vnode_hash_remove(vnode);
+        inode = inode_read(block_buffer, inode_num, super_block);
+        bzero((char *)&vnode->inode, sizeof(inode_t));
+        bcopy((unsigned char *)inode, (unsigned char *)&vnode->inode, super_block->inode_size);
+        vnode->inode_num = inode_num;
+        vnode->open_count = 0;
+        vnode->dir_open_count = 0;
+        vnode->dirty = FALSE;
+        vnode->hash_next = vnode_hash[VNODE_HASH(inode_num)];
+        vnode_hash[VNODE_HASH(inode_num)] = vnode;
+    }
+
+    if (vnode->ref_count == 0)
+        vnode_lru_remove(vnode);
+    vnode->ref_count++;
+    return vnode;
+}
+
+// release a reference taken with vnode_get; the inode stays cached until it is evicted
+void vnode_put(vnode_t *vnode, super_block_t *super_block) {
+    ASSERT(vnode->ref_count > 0);
+    vnode->ref_count--;
+    if (vnode->ref_count == 0)
+        vnode_lru_push_front(vnode);
+}
+
+// note that the in-core inode differs from the one on disk
+void vnode_dirty(vnode_t *vnode) {
+    if (!vnode->dirty)
+        vnode_num_dirty++;
+    vnode->dirty = TRUE;
+}
+
+// write the in-core inode back to its inode block if it changed
+void vnode_write(vnode_t *vnode, super_block_t *super_block) {
+    inode_t *inode;
+    char block_buffer[BLOCK_SIZE];
+
+    if (vnode->inode_num == -1 || !vnode->dirty) { return; }
+
+    inode = inode_read(block_buffer, vnode->inode_num, super_block);
+    bcopy((unsigned char *)&vnode->inode, (unsigned char *)inode, super_block->inode_size);
+    inode_write(block_buffer, vnode->inode_num, super_block);
+    vnode->dirty = FALSE;
+    vnode_num_dirty--;
+}
+
+// write back every dirty in-core inode
+void vnode_sync(super_block_t *super_block) {
+    int i;
+    for (i = 0; i < VNODE_TABLE_SIZE; i++) {
+        vnode_write(&vnode_table[i], super_block);
+    }
+}
+
+// an operation is done: write back the allocation maps it changed, and every few operations the
+// in-core inodes too, committing everything to the log as one transaction. a transaction only
+// ends here, between operations, so it never holds half of one
+void op_end(super_block_t *super_block) {
+    alloc_map_flush(super_block);
+    if (journal_end_op(vnode_num_dirty)) {
+        vnode_sync(super_block);
+        alloc_map_flush(super_block);
+        journal_commit();
+    }
+}
+
+// fill in the type and size of n directory records. an inode cached in core is taken from there,
+// the rest are read an inode block at a time, so each block is read once however many of the
+// records it holds
+void vnode_fill_records(dirEnt *records, int n, super_block_t *super_block) {
+    char block_buffer[BLOCK_SIZE];
+    inode_t *inode;
+    vnode_t *vnode;
+    int per_block = INODES_PER_BLOCK(super_block);
+    int i, j;
+
+    for (i = 0; i < n; i++) {
+        vnode = vnode_find(records[i].inodeNo);
+        records[i].type = (vnode != NULL) ? vnode->inode.type : -1;
+        records[i].size = (vnode != NULL) ? vnode->inode.size : 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (records[i].type != -1) { continue; }
+        inode = inode_read(block_buffer, records[i].inodeNo, super_block);
+        if (inode == NULL) {
+            records[i].type = TYPE_FREE;
+            continue;
+        }
+        // the records whose inodes share this block
+        for (j = i; j < n; j++) {
+            if (records[j].type == -1 && records[j].inodeNo < super_block->max_num_inodes &&
+                inode_block(records[j].inodeNo, super_block) == inode_block(records[i].inodeNo, super_block)) {
+                inode = (inode_t *)&block_buffer[records[j].inodeNo % super_block->group_inodes % per_block *
+                                                 super_block->inode_size];
+                records[j].type = inode->type;
+                records[j].size = inode->size;
+            }
+        }
+    }
+}
+
+// DIRECTORY STUFF
+static void str_copy(char *src, char *dest) {
+    bcopy((unsigned char *)src, (unsigned char *)dest, strlen(src) + 1);
+}
+
+// read a directory entry
+static directory_entry_t *directory_read(char *block_buffer, int data_block_num, int data_block_offset) {
+    directory_entry_t *directory_entries;
+    bcache_read(data_block_num, block_buffer);
+    directory_entries = (directory_entry_t *)block_buffer;
+    return &directory_entries[data_block_offset];
+}
+
+// write a directory entry
+static void directory_write(char *block_buffer, int data_block_num) {
+    bcache_write(data_block_num, block_buffer);
+}
+
+// add a file inode to a linear directory
+static int linear_add(inode_t *dir_inode, char *name, int file_inode_num, int goal, super_block_t *super_block) {
+    directory_entry_t *directory_entry;
+    int current_num_entries;
+    int max_num_entries;
+    int data_block_index;
+    int data_block_offset;
+    int data_new_block;
+    char data_block_buffer[BLOCK_SIZE];
+
+    current_num_entries = dir_inode->size / sizeof(directory_entry_t);
+    max_num_entries = (BLOCK_SIZE / sizeof(directory_entry_t)) * DATA_BLOCK_NUM;
+
+    // check if dir_inode is full and return -1 if full
+    if (current_num_entries >= max_num_entries) { return -1; }
+
+    // calculate the next available entry in the directory
+    data_block_index = current_num_entries / (BLOCK_SIZE / sizeof(directory_entry_t));
+    data_block_offset = current_num_entries % (BLOCK_SIZE / sizeof(directory_entry_t));
+
+    // allocate a new data block if necessary, after the last one or else near goal
+    if (data_block_offset == 0) {
+        if (data_block_index > 0)
+            goal = dir_inode->direct_blocks[data_block_index - 1] + 1;
+        data_new_block = get_free_data(goal, super_block);
+        // if no free blocks return -1
+        if (data_new_block == -1) { return -1; }
+        dir_inode->in_use_blocks++;
+        dir_inode->allocated_blocks++;
+        dir_inode->direct_blocks[data_block_index] = data_new_block;
+        // add 2 to padding if it's not the first block
+        if (data_block_index != 0)
+            dir_inode->size += 2;
+    }
+
+    // add file to data block, a new one is not read since nothing in it is in use yet
+    if (data_block_offset == 0) {
+        bzero_block(data_block_buffer);
+        directory_entry = (directory_entry_t *)data_block_buffer;
+    }
+    else
+        directory_entry = directory_read(data_block_buffer, dir_inode->direct_blocks[data_block_index], data_block_offset);
+    directory_entry->inode = file_inode_num;
+    str_copy(name, directory_entry->name);
+    directory_write(data_block_buffer, dir_inode->direct_blocks[data_block_index]);
+
+    dir_inode->size += sizeof(directory_entry_t);
+
+    return 0;
+}
+
+// remove a file from a linear directory
+static int linear_remove(inode_t *dir_inode, char *name, super_block_t *super_block) {
+    directory_entry_t *directory_entry;
+    directory_entry_t *last_entry;
+    int current_num_entries;
+    int data_block_index;
+    int data_block_offset;
+    int data_block_num;
+    int max_index;
+    int i;
+    uint16_t last_block_index;
+    int last_block_offset;
+    char data_block_buffer[BLOCK_SIZE];
+    char last_block_buffer[BLOCK_SIZE];
+
+    current_num_entries = dir_inode->size / sizeof(directory_entry_t);
+    data_block_offset = current_num_entries % (BLOCK_SIZE / sizeof(directory_entry_t));
+
+    // loop through data blocks to find the entry and remove it
+    for (data_block_index = 0; data_block_index < dir_inode->in_use_blocks; data_block_index++) {
+        data_block_num = dir_inode->direct_blocks[data_block_index];
+        bcache_read(data_block_num, data_block_buffer);
+        directory_entry = (directory_entry_t *)data_block_buffer;
+        if (data_block_index == (dir_inode->in_use_blocks - 1) && data_block_offset != 0)
+            max_index = data_block_offset;
+        else
+            max_index = BLOCK_SIZE / sizeof(directory_entry_t);
+        for (i = 0; i < max_index; i++) {
+            if (same_string(name, directory_entry[i].name)) {
+                dir_inode->size -= sizeof(directory_entry_t);
+                // if this is the only entry in directory, free the block and return
+                if (dir_inode->size == 0) {
+                    data_free(data_block_num, super_block);
+                    dir_inode->direct_blocks[data_block_index] = 0;
+                    dir_inode->in_use_blocks--;
+                    dir_inode->allocated_blocks--;
+                    return 0;
+                }
+                // find last entry and copy into entry being replaced
+                last_block_index = dir_inode->in_use_blocks - 1;
+                if (data_block_offset == 0) {
+                    last_block_offset = BLOCK_SIZE / sizeof(directory_entry_t) - 1;
+                }
+                else {
+                    last_block_offset = data_block_offset - 1;
+                }
+                last_entry = directory_read(last_block_buffer, dir_inode->direct_blocks[last_block_index], last_block_offset);
+                directory_entry[i].inode = last_entry->inode;
+                str_copy(last_entry->name, directory_entry[i].name);
+
+                // write back to block
+                bcache_write(data_block_num, data_block_buffer);
+
+                // free last block if necessary
+                if (last_block_offset == 0) {
+                    data_free(dir_inode->direct_blocks[last_block_index], super_block);
+                    dir_inode->direct_blocks[last_block_index] = 0;
+                    dir_inode->in_use_blocks--;
+                    dir_inode->allocated_blocks--;
+                    dir_inode->size -= 2;
+                }
+
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+// return the inode of the file we are looking for in a linear directory
+static int linear_find(inode_t *dir_inode, char *name, super_block_t *super_block) {
+    directory_entry_t *directory_entry;
+    char data_block_buffer[BLOCK_SIZE];
+    int i, j;
+    int current_num_entries;
+    int data_block_offset;
+    int max_index;
+
+    current_num_entries = dir_inode->size / sizeof(directory_entry_t);
+    data_block_offset = current_num_entries % (BLOCK_SIZE / sizeof(directory_entry_t));
+
+    for (i = 0; i < dir_inode->in_use_blocks; i++) {
+        bcache_read(dir_inode->direct_blocks[i], data_block_buffer);
+        directory_entry = (directory_entry_t *)data_block_buffer;
+        if (i == (dir_inode->in_use_blocks - 1) && data_block_offset != 0)
+            max_index = data_block_offset;
+        else
+            max_index = BLOCK_SIZE / sizeof(directory_entry_t);
+        for (j = 0; j < max_index; j++) {
+            if (same_string(name, directory_entry[j].name)) {
+                return directory_entry[j].inode;
+            }
+        }
+    }
+
+    return -1;
+}
+
+// INLINE DIRECTORY STUFF
+
+#define INLINE_ENTRIES (INODE_INLINE_SIZE / sizeof(directory_entry_t))
+
+// a small directory keeps its entries in the inode, laid out the way a linear directory block is
+static int inline_add(inode_t *dir_inode, char *name, int file_inode_num) {
+    directory_entry_t *entries = (directory_entry_t *)dir_inode->inline_data;
+    int n = dir_inode->size / sizeof(directory_entry_t);
+
+    if (n >= INLINE_ENTRIES) { return -1; }
+    entries[n].inode = file_inode_num;
+    str_copy(name, entries[n].name);
+    dir_inode->size += sizeof(directory_entry_t);
+    return 0;
+}
+
+static int inline_remove(inode_t *dir_inode, char *name) {
+    directory_entry_t *entries = (directory_entry_t *)dir_inode->inline_data;
+    int n = dir_inode->size / sizeof(directory_entry_t);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (same_string(name, entries[i].name)) {
+            // the last entry takes the place of the removed one
+            bcopy((unsigned char *)&entries[n - 1], (unsigned char *)&entries[i], sizeof(directory_entry_t));
+            bzero((char *)&entries[n - 1], sizeof(directory_entry_t));
+            dir_inode->size -= sizeof(directory_entry_t);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int inline_find(inode_t *dir_inode, char *name) {
+    directory_entry_t *entries = (directory_entry_t *)dir_inode->inline_data;
+    int n = dir_inode->size / sizeof(directory_entry_t);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (same_string(name, entries[i].name))
+            return entries[i].inode;
+    }
+    return -1;
+}
+
+// HASHED DIRECTORY STUFF
+
+// FNV-1a hash of a file name
+static uint32_t name_hash(char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+// add an empty block to the end of an indexed directory and return its file block index
+static int index_grow(inode_t *dir_inode, super_block_t *super_block) {
+    if (inode_grow(dir_inode, 1, super_block) == -1) { return -1; }
+    dir_inode->size = dir_inode->in_use_blocks * BLOCK_SIZE;
+    return dir_inode->in_use_blocks - 1;
+}
+
+// file block of the leaf the hash of name points to
+static int index_leaf(dir_root_t *root, char *name) {
+    return root->leaves[name_hash(name) & ((1 << root->depth) - 1)];
+}
+
+// look for name in the chain of leaves starting at file block leaf_index. if it is found the
+// leaf holding it is left in leaf_buffer, its file block in *found_index, and its slot is returned
+static int index_leaf_find(inode_t *dir_inode, int leaf_index, char *name, char *leaf_buffer,
+                           int *found_index, super_block_t *super_block) {
+    dir_leaf_t *leaf = (dir_leaf_t *)leaf_buffer;
+    int i;
+
+    while (leaf_index != 0) {
+        bcache_read(inode_bmap(dir_inode, leaf_index, super_block), leaf_buffer);
+        for (i = 0; i < leaf->count; i++) {
+            if (same_string(name, leaf->entries[i].name)) {
+                *found_index = leaf_index;
+                return i;
+            }
+        }
+        leaf_index = leaf->next;
+    }
+    return -1;
+}
+
+// move the entries of a leaf with the next hash bit set into the empty leaf at new_index,
+// and point the root slots for that bit at it
+static void index_split(inode_t *dir_inode, dir_root_t *root, int leaf_index, char *leaf_buffer,
+                        int new_index, super_block_t *super_block) {
+    char new_buffer[BLOCK_SIZE];
+    dir_leaf_t *leaf = (dir_leaf_t *)leaf_buffer;
+    dir_leaf_t *new_leaf = (dir_leaf_t *)new_buffer;
+    uint32_t bit = 1 << leaf->depth;
+    int i;
+
+    bzero_block(new_buffer);
+    leaf->depth++;
+    new_leaf->depth = leaf->depth;
+    for (i = 0; i < leaf->count; ) {
+        if (name_hash(leaf->entries[i].name) & bit) {
+            bcopy((unsigned char *)&leaf->entries[i], (unsigned char *)&new_leaf->entries[new_leaf->count], sizeof(directory_entry_t));
+            new_leaf->count++;
+            leaf->count--;
+            bcopy((unsigned char *)&leaf->entries[leaf->count], (unsigned char *)&leaf->entries[i], sizeof(directory_entry_t));
+        }
+        else {
+            i++;
+        }
+    }
+    for (i = 0; i < (1 << root->depth); i++) {
+        if (root->leaves[i] == leaf_index && (i & bit))
+            root->leaves[i] = new_index;
+    }
+    bcache_write(inode_bmap(dir_inode, leaf_index, super_block), leaf_buffer);
+    bcache_write(inode_bmap(dir_inode, new_index, super_block), new_buffer);
+}
+
+// add a file inode to an indexed directory, splitting the leaf it hashes to when it is full
+static int index_add(inode_t *dir_inode, char *name, int file_inode_num, super_block_t *super_block) {
+    char root_buffer[BLOCK_SIZE];
+    char leaf_buffer[BLOCK_SIZE];
+    dir_root_t *root = (dir_root_t *)root_buffer;
+    dir_leaf_t *leaf = (dir_leaf_t *)leaf_buffer;
+    directory_entry_t *directory_entry;
+    int root_block;
+    int leaf_index;
+    int new_index;
+    int slots;
+    int status = 0;
+
+    root_block = inode_bmap(dir_inode, 0, super_block);
+    bcache_read(root_block, root_buffer);
+    leaf_index = index_leaf(root, name);
+
+    while (1) {
+        bcache_read(inode_bmap(dir_inode, leaf_index, super_block), leaf_buffer);
+        if (leaf->count < DIR_LEAF_ENTRIES) { break; }
+        if (leaf->next != 0) {
+            leaf_index = leaf->next;
+            continue;
+        }
+
+        new_index = index_grow(dir_inode, super_block);
+        if (new_index == -1) {
+            status = -1;
+            break;
+        }
+
+        // split the leaf on its next hash bit, doubling the root if the leaf already uses all of its bits
+        if (leaf->depth < DIR_MAX_DEPTH) {
+            if (leaf->depth == root->depth) {
+                slots = 1 << root->depth;
+                bcopy((unsigned char *)root->leaves, (unsigned char *)&root->leaves[slots], slots * sizeof(uint16_t));
+                root->depth++;
+            }
+            index_split(dir_inode, root, leaf_index, leaf_buffer, new_index, super_block);
+            leaf_index = index_leaf(root, name);
+            continue;
+        }
+
+        // the hash prefix can't be split any further, so chain an overflow leaf to the full one
+        leaf->next = new_index;
+        bcache_write(inode_bmap(dir_inode, leaf_index, super_block), leaf_buffer);
+        bzero_block(leaf_buffer);
+        leaf->depth = DIR_MAX_DEPTH;
+        leaf_index = new_index;
+        break;
+    }
+
+    if (status == 0) {
+        directory_entry = &leaf->entries[leaf->count];
+        directory_entry->inode = file_inode_num;
+        str_copy(name, directory_entry->name);
+        leaf->count++;
+        bcache_write(inode_bmap(dir_inode, leaf_index, super_block), leaf_buffer);
+        root->num_entries++;
+    }
+    bcache_write(root_block, root_buffer);
+
+    return status;
+}
+
+// remove a file from an indexed directory
+static int index_remove(inode_t *dir_inode, char *name, super_block_t *super_block) {
+    char root_buffer[BLOCK_SIZE];
+    char leaf_buffer[BLOCK_SIZE];
+    dir_root_t *root = (dir_root_t *)root_buffer;
+    dir_leaf_t *leaf = (dir_leaf_t *)leaf_buffer;
+    int root_block;
+    int leaf_index;
+    int i;
+
+    root_block = inode_bmap(dir_inode, 0, super_block);
+    bcache_read(root_block, root_buffer);
+    i = index_leaf_find(dir_inode, index_leaf(root, name), name, leaf_buffer, &leaf_index, super_block);
+    if (i == -1) { return -1; }
+
+    // fill the hole with the last entry of the leaf
+    leaf->count--;
+    bcopy((unsigned char *)&leaf->entries[leaf->count], (unsigned char *)&leaf->entries[i], sizeof(directory_entry_t));
+    bcache_write(inode_bmap(dir_inode, leaf_index, super_block), leaf_buffer);
+
+    root->num_entries--;
+    bcache_write(root_block, root_buffer);
+    return 0;
+}
+
+// return the inode of the file we are looking for in an indexed directory
+static int index_find(inode_t *dir_inode, char *name, super_block_t *super_block) {
+    char leaf_buffer[BLOCK_SIZE];
+    dir_leaf_t *leaf = (dir_leaf_t *)leaf_buffer;
+    int leaf_index;
+    int i;
+
+    // the root is only needed for the leaf number, the leaf buffer can be reused after
+    bcache_read(inode_bmap(dir_inode, 0, super_block), leaf_buffer);
+    leaf_index = index_leaf((dir_root_t *)leaf_buffer, name);
+    i = index_leaf_find(dir_inode, leaf_index, name, leaf_buffer, &leaf_index, super_block);
+    if (i == -1) { return -1; }
+    return leaf->entries[i].inode;
+}
+
+// turn a full one block linear directory into an indexed one: its entries move to a new
+// leaf and block 0 becomes the index root
+static int dir_make_indexed(inode_t *dir_inode, super_block_t *super_block) {
+    char root_buffer[BLOCK_SIZE];
+    char leaf_buffer[BLOCK_SIZE];
+    dir_root_t *root = (dir_root_t *)root_buffer;
+    dir_leaf_t *leaf = (dir_leaf_t *)leaf_buffer;
+    int num_entries = dir_inode->size / sizeof(directory_entry_t);
+    int root_block = dir_inode->direct_blocks[0];
+
+    ASSERT(dir_inode->in_use_blocks == 1 && num_entries <= DIR_LEAF_ENTRIES);
+    if (inode_grow(dir_inode, 1, super_block) == -1) { return -1; }
+
+    bcache_read(root_block, root_buffer);
+    bzero_block(leaf_buffer);
+    bcopy((unsigned char *)root_buffer, (unsigned char *)leaf->entries, num_entries * sizeof(directory_entry_t));
+    leaf->count = num_entries;
+    bcache_write(inode_bmap(dir_inode, 1, super_block), leaf_buffer);
+
+    bzero_block(root_buffer);
+    root->num_entries = num_entries;
+    root->leaves[0] = 1;
+    bcache_write(root_block, root_buffer);
+
+    dir_inode->flags |= INODE_DIR_INDEXED;
+    dir_inode->size = dir_inode->in_use_blocks * BLOCK_SIZE;
+    return 0;
+}
+
+// NAME LOOKUP CACHE STUFF
+
+typedef struct dentry {
+    int dir; // inode of the directory the name is in, -1 if this entry is unused
+    int inode; // inode the name refers to, -1 if the name is known not to exist
+    uint32_t hash; // name_hash of the name
+    char name[MAX_FILE_NAME_COPY + 1];
+    struct dentry *hash_next; // next entry in the same hash bucket
+    struct dentry *lru_prev; // more recently used neighbour
+    struct dentry *lru_next; // less recently used neighbour
+} dentry_t;
+
+static dentry_t dentries[DCACHE_SIZE];
+static dentry_t *dentry_hash[DCACHE_HASH_SIZE];
+static dentry_t *dentry_lru_head; // most recently used entry
+static dentry_t *dentry_lru_tail; // least recently used entry, first to be reused
+static uint32_t dcache_hits;
+static uint32_t dcache_misses;
+
+#define DENTRY_HASH(dir, hash) (((dir) * 31 + (hash)) & (DCACHE_HASH_SIZE - 1))
+
+static void dentry_lru_remove(dentry_t *dentry) {
+    if (dentry->lru_prev != NULL)
+        dentry->lru_prev->lru_next = dentry->lru_next;
+    else
+        dentry_lru_head = dentry->lru_next;
+    if (dentry->lru_next != NULL)
+        dentry->lru_next->lru_prev = dentry->lru_prev;
+    else
+        dentry_lru_tail = dentry->lru_prev;
+}
+
+static void dentry_lru_push_front(dentry_t *dentry) {
+    dentry->lru_prev = NULL;
+    dentry->lru_next = dentry_lru_head;
+    if (dentry_lru_head != NULL)
+        dentry_lru_head->lru_prev = dentry;
+    dentry_lru_head = dentry;
+    if (dentry_lru_tail == NULL)
+        dentry_lru_tail = dentry;
+}
+
+static void dentry_hash_remove(dentry_t *dentry) {
+    dentry_t **link;
+    for (link = &dentry_hash[DENTRY_HASH(dentry->dir, dentry->hash)]; *link != NULL; link = &(*link)->hash_next) {
+        if (*link == dentry) {
+            *link = dentry->hash_next;
+            return;
+        }
+    }
+}
+
+// forget every cached name, used when the disk is reformatted
+void dcache_init(void) {
+    int i;
+
+    bzero((char *)dentry_hash, sizeof(dentry_hash));
+    dentry_lru_head = NULL;
+    dentry_lru_tail = NULL;
+    for (i = 0; i < DCACHE_SIZE; i++) {
+        dentries[i].dir = -1;
+        dentries[i].hash_next = NULL;
+        dentry_lru_push_front(&dentries[i]);
+    }
+}
+
+// find the cached entry for name in directory dir, otherwise return NULL
+static dentry_t *dcache_find(int dir, char *name, uint32_t hash) {
+    dentry_t *dentry;
+    for (dentry = dentry_hash[DENTRY_HASH(dir, hash)]; dentry != NULL; dentry = dentry->hash_next) {
+        if (dentry->dir == dir && dentry->hash == hash && same_string(name, dentry->name)) {
+            dentry_lru_remove(dentry);
+            dentry_lru_push_front(dentry);
+            return dentry;
+        }
+    }
+    return NULL;
+}
+
+// remember that name in directory dir refers to inode, -1 meaning it does not exist
+static void dcache_enter(int dir, char *name, int inode) {
+    uint32_t hash;
+    dentry_t *dentry;
+
+    if (strlen(name) > MAX_FILE_NAME_COPY) { return; }
+    hash = name_hash(name);
+    dentry = dcache_find(dir, name, hash);
+
+    // reuse the least recently used entry for a new name
+    if (dentry == NULL) {
+        dentry = dentry_lru_tail;
+        if (dentry->dir != -1)
+            dentry_hash_remove(dentry);
+        dentry->dir = dir;
+        dentry->hash = hash;
+        str_copy(name, dentry->name);
+        dentry->hash_next = dentry_hash[DENTRY_HASH(dir, hash)];
+        dentry_hash[DENTRY_HASH(dir, hash)] = dentry;
+        dentry_lru_remove(dentry);
+        dentry_lru_push_front(dentry);
+    }
+    dentry->inode = inode;
+}
+
+// drop every name cached for directory dir, used once the directory is removed
+void dcache_purge_dir(int dir) {
+    int i;
+    for (i = 0; i < DCACHE_SIZE; i++) {
+        if (dentries[i].dir == dir) {
+            dentry_hash_remove(&dentries[i]);
+            dentries[i].dir = -1;
+        }
+    }
+}
+
+void dcache_get_stats(uint32_t *hits, uint32_t *misses) {
+    *hits = dcache_hits;
+    *misses = dcache_misses;
+}
+
+// DIRECTORY INTERFACE
+
+// add a file inode to a directory
+int dir_add(char *name, int dir_inode_num, int file_inode_num, super_block_t *super_block) {
+    vnode_t *dir_vnode;
+    inode_t *dir_inode;
+    int status;
+
+    dir_vnode = vnode_get(dir_inode_num, super_block);
+    dir_inode = &dir_vnode->inode;
+
+    // an inline directory moves to a block of its own once the inode is full
+    if ((dir_inode->flags & INODE_INLINE) && dir_inode->size / sizeof(directory_entry_t) >= INLINE_ENTRIES) {
+        if (inode_uninline(dir_inode, inode_home(dir_inode_num, super_block), super_block) == -1) {
+            vnode_put(dir_vnode, super_block);
+            return -1;
+        }
+        dir_vnode->map_gen++;
+        vnode_dirty(dir_vnode);
+    }
+
+    // a linear directory is indexed once it fills the one block it may use
+    if (!(dir_inode->flags & INODE_DIR_INDEXED) &&
+        dir_inode->size / sizeof(directory_entry_t) >= DIR_LEAF_ENTRIES) {
+        if (dir_make_indexed(dir_inode, super_block) == -1) {
+            vnode_put(dir_vnode, super_block);
+            return -1;
+        }
+        vnode_dirty(dir_vnode);
+    }
+
+    if (dir_inode->flags & INODE_INLINE)
+        status = inline_add(dir_inode, name, file_inode_num);
+    else if (dir_inode->flags & INODE_DIR_INDEXED)
+        status = index_add(dir_inode, name, file_inode_num, super_block);
+    else
+        status = linear_add(dir_inode, name, file_inode_num, inode_home(dir_inode_num, super_block), super_block);
+    if (status == 0)
+        dcache_enter(dir_inode_num, name, file_inode_num);
+
+    vnode_dirty(dir_vnode);
+    vnode_put(dir_vnode, super_block);
+    return status;
+}
+
+// remove a file from a directory
+int dir_remove(int dir_inode_num, char *name, super_block_t *super_block) {
+    vnode_t *dir_vnode;
+    int status;
+
+    dir_vnode = vnode_get(dir_inode_num, super_block);
+    if (dir_vnode->inode.flags & INODE_INLINE)
+        status = inline_remove(&dir_vnode->inode, name);
+    else if (dir_vnode->inode.flags & INODE_DIR_INDEXED)
+        status = index_remove(&dir_vnode->inode, name, super_block);
+    else
+        status = linear_remove(&dir_vnode->inode, name, super_block);
+    if (status == 0) {
+        dcache_enter(dir_inode_num, name, -1);
+        vnode_dirty(dir_vnode);
+    }
+    vnode_put(dir_vnode, super_block);
+    return status;
+}
+
+// return the inode of the file we are looking for
+int dir_find(int dir_inode_num, char *name, super_block_t *super_block) {
+    vnode_t *dir_vnode;
+    dentry_t *dentry;
+    int inode_num;
+
+    // names looked up recently, including ones that were not there, are answered from the cache
+    dentry = dcache_find(dir_inode_num, name, name_hash(name));
+    if (dentry != NULL) {
+        dcache_hits++;
+        return dentry->inode;
+    }
+    dcache_misses++;
+
+    dir_vnode = vnode_get(dir_inode_num, super_block);
+    if (dir_vnode->inode.flags & INODE_INLINE)
+        inode_num = inline_find(&dir_vnode->inode, name);
+    else if (dir_vnode->inode.flags & INODE_DIR_INDEXED)
+        inode_num = index_find(&dir_vnode->inode, name, super_block);
+    else
+        inode_num = linear_find(&dir_vnode->inode, name, super_block);
+    vnode_put(dir_vnode, super_block);
+    dcache_enter(dir_inode_num, name, inode_num);
+    return inode_num;
+}
+
+// return TRUE if a directory only holds "." and ".."
+bool_t dir_is_empty(int dir_inode_num, super_block_t *super_block) {
+    vnode_t *dir_vnode;
+    char root_buffer[BLOCK_SIZE];
+    int num_entries;
+
+    dir_vnode = vnode_get(dir_inode_num, super_block);
+    if (dir_vnode->inode.flags & INODE_DIR_INDEXED) {
+        bcache_read(inode_bmap(&dir_vnode->inode, 0, super_block), root_buffer);
+        num_entries = ((dir_root_t *)root_buffer)->num_entries;
+    }
+    else {
+        num_entries = dir_vnode->inode.size / sizeof(directory_entry_t);
+    }
+    vnode_put(dir_vnode, super_block);
+    return num_entries == 2;
+}
+
+// copy the directory entry at *position into entry and move *position past it; return -1 once
+// there are no entries left. a linear position is an entry index, an indexed one is the leaf
+// file block times DIR_POSITION_SLOTS plus the slot in that leaf
+int dir_next_entry(int dir_inode_num, int *position, directory_entry_t *entry, super_block_t *super_block) {
+    vnode_t *dir_vnode;
+    inode_t *dir_inode;
+    char block_buffer[BLOCK_SIZE];
+    dir_leaf_t *leaf = (dir_leaf_t *)block_buffer;
+    int per_block = BLOCK_SIZE / sizeof(directory_entry_t);
+    int leaf_index, slot;
+    int status = -1;
+
+    dir_vnode = vnode_get(dir_inode_num, super_block);
+    dir_inode = &dir_vnode->inode;
+
+    if (dir_inode->flags & INODE_INLINE) {
+        if (*position < dir_inode->size / sizeof(directory_entry_t)) {
+            bcopy((unsigned char *)&((directory_entry_t *)dir_inode->inline_data)[*position],
+                  (unsigned char *)entry, sizeof(directory_entry_t));
+            (*position)++;
+            status = 0;
+        }
+    }
+    else if (!(dir_inode->flags & INODE_DIR_INDEXED)) {
+        if (*position < dir_inode->size / sizeof(directory_entry_t)) {
+            bcache_read(dir_inode->direct_blocks[*position / per_block], block_buffer);
+            bcopy((unsigned char *)&((directory_entry_t *)block_buffer)[*position % per_block],
+                  (unsigned char *)entry, sizeof(directory_entry_t));
+            (*position)++;
+            status = 0;
+        }
+    }
+    else {
+        // every block after the root is a leaf, walk them in order
+        leaf_index = *position / DIR_POSITION_SLOTS;
+        slot = *position % DIR_POSITION_SLOTS;
+        if (leaf_index == 0)
+            leaf_index = 1;
+        for (; leaf_index < dir_inode->in_use_blocks; leaf_index++, slot = 0) {
+            bcache_read(inode_bmap(dir_inode, leaf_index, super_block), block_buffer);
+            if (slot < leaf->count) {
+                bcopy((unsigned char *)&leaf->entries[slot], (unsigned char *)entry, sizeof(directory_entry_t));
+                *position = leaf_index * DIR_POSITION_SLOTS + slot + 1;
+                status = 0;
+                break;
+            }
+        }
+    }
+
+    vnode_put(dir_vnode, super_block);
+    return status;
+}
+
+// FILE DESCRIPTOR STUFF
+
+static file_t file_table[MAX_OPEN_FILES]; // open files shared by every process
+static int file_free; // first free entry of file_table, the free ones are chained by next_free
+
+// forget every open file, used when the disk is reformatted
+void file_table_init(void) {
+    int i;
+
+    bzero((char *)file_table, sizeof(file_table));
+    for (i = 0; i < MAX_OPEN_FILES; i++) {
+        file_table[i].next_free = i + 1;
+    }
+    file_table[MAX_OPEN_FILES - 1].next_free = -1;
+    file_free = 0;
+}
+
+// take an entry of the open file table for vnode, opened with permissions in directory dir_vnode;
+// the entry keeps both references until it is closed. return NULL if the table is full
+file_t *file_open(vnode_t *vnode, int permissions, vnode_t *dir_vnode) {
+    file_t *file;
+
+    if (file_free == -1) { return NULL; }
+    file = &file_table[file_free];
+    file_free = file->next_free;
+
+    file->open = TRUE;
+    file->permissions = permissions;
+    file->vnode = vnode;
+    file->dir_vnode = dir_vnode;
+    file->position = 0;
+    file->map_count = 0;
+    file->ra_position = 0;
+    file->ra_end = 0;
+    file->ra_window = 0;
+    vnode->open_count++;
+    dir_vnode->dir_open_count++;
+    return file;
+}
+
+// give an entry back to the open file table, the caller drops the vnode references
+void file_close(file_t *file) {
+    file->vnode->open_count--;
+    file->dir_vnode->dir_open_count--;
+    file->open = FALSE;
+    file->next_free = file_free;
+    file_free = file - file_table;
+}
+
+// point the lowest free descriptor of a process at file, return -1 if it has none left
+int fd_alloc(fdTable *fds, file_t *file) {
+    int i, fd;
+
+    // a word of the bitmap at a time
+    for (i = 0; i < MAX_FILE_DESCRIPTORS / 32; i++) {
+        if (fds->used[i] != 0xffffffff) {
+            fd = i * 32 + __builtin_ctz(~fds->used[i]);
+            fds->used[i] |= (uint32_t) 1 << (fd % 32);
+            fds->files[fd] = file - file_table;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+// the open file behind descriptor fd of a process, NULL if fd is not open
+file_t *fd_lookup(fdTable *fds, int fd) {
+    if (fd < 0 || fd >= MAX_FILE_DESCRIPTORS) { return NULL; }
+    if (!((fds->used[fd / 32] >> (fd % 32)) & 1)) { return NULL; }
+    return &file_table[fds->files[fd]];
+}
+
+// free descriptor fd of a process
+void fd_free(fdTable *fds, int fd) {
+    fds->used[fd / 32] &= ~((uint32_t) 1 << (fd % 32));
+}
+
+// the lowest open descriptor of a process, -1 if it has none
+int fd_first(fdTable *fds) {
+    int i;
+    for (i = 0; i < MAX_FILE_DESCRIPTORS / 32; i++) {
+        if (fds->used[i] != 0)
+            return i * 32 + __builtin_ctz(fds->used[i]);
+    }
+    return -1;
+}
+
+// return the disk block holding file block index of an open file and store in *run how many
+// blocks from there on follow it on disk; the descriptor's window of runs is refilled from
+// the inode when index falls outside of it. return 0 if index is not mapped
+int fd_bmap(file_t *file, int index, int *run, super_block_t *super_block) {
+    inode_t *inode = &file->vnode->inode;
+    extent_t *extent;
+    int i;
+
+    if (file->map_gen != file->vnode->map_gen || file->map_count == 0 ||
+        index < file->map_runs[0].file_block) {
+        file->map_count = 0;
+    }
+    for (i = 0; i < file->map_count; i++) {
+        extent = &file->map_runs[i];
+        if (index < extent->file_block + extent->length) { break; }
+    }
+    if (i == file->map_count) {
+        file->map_count = map_fill(inode, index, inode->in_use_blocks, file->map_runs, FD_MAP_RUNS);
+        file->map_gen = file->vnode->map_gen;
+        if (file->map_count == 0) { return 0; }
+        i = 0;
+    }
+
+    extent = &file->map_runs[i];
+    *run = extent->file_block + extent->length - index;
+    return extent->start + (index - extent->file_block);
+}
+
+// called after count bytes were read at position through file. a read that continues where
+// the previous one stopped marks the descriptor as sequential; each time such a reader moves
+// into a new block and gets within half a window of what was already read ahead, the next
+// blocks of the file are brought into the cache with batched transfers and the window doubles.
+// any other read resets the descriptor to random access, which never reads ahead
+void fd_readahead(file_t *file, int position, int count, super_block_t *super_block) {
+    int last, start, end, blocks;
+    int block_num, run;
+
+    if (position != file->ra_position) {
+        file->ra_position = position + count;
+        file->ra_window = 0;
+        file->ra_end = 0;
+        return;
+    }
+    file->ra_position = position + count;
+
+    // a reader moving several blocks per call already gets them in long transfers that
+    // bypass the cache, reading ahead would only stage them there
+    if (count >= BCACHE_DIRECT_RUN * BLOCK_SIZE) { return; }
+
+    // nothing to do while the reader stays inside a block it already touched
+    last = (position + count - 1) / BLOCK_SIZE;
+    if (position % BLOCK_SIZE != 0 && position / BLOCK_SIZE == last) { return; }
+    if (last + 1 + file->ra_window / 2 < file->ra_end) { return; }
+
+    if (file->ra_window == 0)
+        file->ra_window = RA_MIN_WINDOW;
+    else if (file->ra_window < RA_MAX_WINDOW)
+        file->ra_window *= 2;
+
+    start = last + 1;
+    if (start < file->ra_end)
+        start = file->ra_end;
+    end = last + 1 + file->ra_window;
+    blocks = (file->vnode->inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (end > blocks)
+        end = blocks;
+    file->ra_end = end;
+
+    while (start < end) {
+        block_num = fd_bmap(file, start, &run, super_block);
+        if (block_num == 0) { break; }
+        if (run > end - start)
+            run = end - start;
+        bcache_prefetch(block_num, run);
+        start += run;
+    }
+}
+
+// FSCK STUFF
+
+// what the checker rebuilds from the inode table and the directory tree
+static uint32_t fsck_blocks[(FS_MAX_SIZE + 31) / 32]; // blocks the layout or some inode uses
+static uint8_t fsck_shares[FS_MAX_SIZE]; // inodes claiming each block besides the first
+static uint32_t fsck_used[(FS_MAX_INODES + 31) / 32]; // inodes in use in the inode table
+static uint32_t fsck_dirs[(FS_MAX_INODES + 31) / 32]; // inodes in use that are directories
+static uint16_t fsck_links[FS_MAX_INODES]; // link count each inode in use claims
+static uint16_t fsck_refs[FS_MAX_INODES]; // entries naming each inode, "." and ".." left out
+static char fsck_buffer[FSCK_RUN * BLOCK_SIZE]; // inode table blocks being checked
+
+#define FSCK_TEST(bits, i) (((bits)[(i) / 32] >> ((i) % 32)) & 1)
+#define FSCK_SET(bits, i) ((bits)[(i) / 32] |= ((uint32_t) 1 << ((i) % 32)))
+#define FSCK_CLEAR(bits, i) ((bits)[(i) / 32] &= ~((uint32_t) 1 << ((i) % 32)))
+
+// TRUE if an open file descriptor still holds inode_num, so it is not an orphan even without links
+static bool_t vnode_is_open(int inode_num) {
+    vnode_t *vnode = vnode_find(inode_num);
+    return vnode != NULL && vnode->open_count > 0;
+}
+
+// note that block is used, return FALSE if it cannot be or another inode already claimed it. with
+// shared set the block holds file data, which clones may claim again
+static bool_t fsck_claim(int block, bool_t shared, fsckInfo *report, super_block_t *super_block) {
+    if (!block_is_data(block, super_block)) {
+        report->badBlocks++;
+        return FALSE;
+    }
+    if (FSCK_TEST(fsck_blocks, block)) {
+        if (!shared || fsck_shares[block] == REF_MAX) {
+            report->badBlocks++;
+            return FALSE;
+        }
+        fsck_shares[block]++;
+        return TRUE;
+    }
+    FSCK_SET(fsck_blocks, block);
+    return TRUE;
+}
+
+// count the references made by n directory entries
+static void fsck_entries(directory_entry_t *entries, int n, fsckInfo *report, super_block_t *super_block) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (same_string(entries[i].name, ".") || same_string(entries[i].name, "..")) { continue; }
+        if (entries[i].inode >= super_block->max_num_inodes) {
+            report->badEntries++;
+            continue;
+        }
+        if (fsck_refs[entries[i].inode] < 0xffff)
+            fsck_refs[entries[i].inode]++;
+    }
+}
+
+// claim file block index of inode at block; directory blocks are read once for their entries
+static void fsck_data(inode_t *inode, int index, int block, fsckInfo *report, super_block_t *super_block) {
+    char block_buffer[BLOCK_SIZE];
+    dir_leaf_t *leaf = (dir_leaf_t *)block_buffer;
+    int per_block = BLOCK_SIZE / sizeof(directory_entry_t);
+    int n;
+
+    if (!fsck_claim(block, inode->type == TYPE_FILE, report, super_block)) { return; }
+    if (inode->type != TYPE_DIRECTORY) { return; }
+
+    bcache_read(block, block_buffer);
+    if (inode->flags & INODE_DIR_INDEXED) {
+        // block 0 is the root, it only maps hash prefixes to the leaves
+        if (index > 0 && leaf->count <= DIR_LEAF_ENTRIES)
+            fsck_entries(leaf->entries, leaf->count, report, super_block);
+    }
+    else {
+        n = inode->size / sizeof(directory_entry_t) - index * per_block;
+        if (n > per_block)
+            n = per_block;
+        fsck_entries((directory_entry_t *)block_buffer, n, report, super_block);
+    }
+}
+
+// claim the blocks a pointer block at depth maps, starting at file block index; return how
+// many file blocks one pointer block at this depth covers
+static int fsck_ptr_block(inode_t *inode, int block, int depth, int index, fsckInfo *report,
+                          super_block_t *super_block) {
+    uint32_t ptrs[PTRS_PER_BLOCK];
+    int span = (depth == 0) ? 1 : PTRS_PER_BLOCK;
+    int i;
+
+    if (block == 0 || !fsck_claim(block, FALSE, report, super_block)) { return span * PTRS_PER_BLOCK; }
+    bcache_read(block, (char *)ptrs);
+    for (i = 0; i < PTRS_PER_BLOCK; i++) {
+        if (ptrs[i] == 0) { continue; }
+        if (depth == 0)
+            fsck_data(inode, index + i, ptrs[i], report, super_block);
+        else
+            fsck_ptr_block(inode, ptrs[i], depth - 1, index + i * span, report, super_block);
+    }
+    return span * PTRS_PER_BLOCK;
+}
+
+// claim every block an inode uses, reading each of its mapping and directory blocks once
+static void fsck_inode(inode_t *inode, fsckInfo *report, super_block_t *super_block) {
+    char buffer[BLOCK_SIZE];
+    extent_t *more = NULL;
+    extent_t *extent;
+    int i, j;
+
+    if (inode->flags & INODE_INLINE) {
+        if (inode->type == TYPE_DIRECTORY && inode->size <= INODE_INLINE_SIZE)
+            fsck_entries((directory_entry_t *)inode->inline_data, inode->size / sizeof(directory_entry_t),
+                         report, super_block);
+    }
+    else if (inode->flags & INODE_EXTENT_MAPPED) {
+        if (inode->num_extents > MAX_EXTENTS) {
+            report->badBlocks++;
+            return;
+        }
+        if (inode->extent_block != 0 && fsck_claim(inode->extent_block, FALSE, report, super_block))
+            more = extent_block_read(inode, buffer);
+        for (i = 0; i < inode->num_extents; i++) {
+            if (i >= INODE_EXTENTS && more == NULL) { break; }
+            extent = extent_at(inode, more, i);
+            for (j = 0; j < extent->length; j++) {
+                fsck_data(inode, extent->file_block + j, extent->start + j, report, super_block);
+            }
+        }
+    }
+    else {
+        for (i = 0; i < DATA_BLOCK_NUM; i++) {
+            if (inode->direct_blocks[i] != 0)
+                fsck_data(inode, i, inode->direct_blocks[i], report, super_block);
+        }
+        i = DATA_BLOCK_NUM;
+        i += fsck_ptr_block(inode, inode->indirect_block, 0, i, report, super_block);
+        fsck_ptr_block(inode, inode->double_indirect_block, 1, i, report, super_block);
+    }
+}
+
+// an orphaned directory is about to be freed, drop the references its entries made
+static void fsck_drop_entries(int dir, super_block_t *super_block) {
+    directory_entry_t entry;
+    int position = 0;
+
+    while (dir_next_entry(dir, &position, &entry, super_block) == 0) {
+        if (same_string(entry.name, ".") || same_string(entry.name, "..")) { continue; }
+        if (entry.inode < super_block->max_num_inodes && fsck_refs[entry.inode] > 0)
+            fsck_refs[entry.inode]--;
+    }
+}
+
+// take the entries naming an inode that is not in use out of directory dir. a removal moves
+// another entry into the hole, so the names are gathered first and the directory read again
+static void fsck_remove_entries(int dir, super_block_t *super_block) {
+    directory_entry_t entry;
+    char names[FSCK_NAMES][MAX_FILE_NAME_COPY + 1];
+    int position;
+    int n, i;
+
+    do {
+        n = 0;
+        position = 0;
+        while (n < FSCK_NAMES && dir_next_entry(dir, &position, &entry, super_block) == 0) {
+            if (same_string(entry.name, ".") || same_string(entry.name, "..")) { continue; }
+            if (entry.inode < super_block->max_num_inodes && FSCK_TEST(fsck_used, entry.inode)) { continue; }
+            bcopy((unsigned char *)entry.name, (unsigned char *)names[n], MAX_FILE_NAME_COPY);
+            names[n][MAX_FILE_NAME_COPY] = '\0';
+            n++;
+        }
+        for (i = 0; i < n; i++) {
+            dir_remove(dir, names[i], super_block);
+        }
+        op_end(super_block);
+    } while (n == FSCK_NAMES);
+}
+
+// check the file system on disk in one sequential pass over its metadata: the super block, the
+// inode table of each group with the blocks each inode maps, then the group descriptors, the
+// allocation maps and the reference counts.
+// with repair set those are corrected, link counts fixed, orphaned inodes freed along with what
+// they held and entries naming free inodes removed. the caller syncs before and after, so the
+// disk and the caches agree
+void fsck_check(fsckInfo *report, bool_t repair, super_block_t *super_block) {
+    super_block_t expected;
+    group_desc_t desc;
+    inode_t inode;
+    int per_block = INODES_PER_BLOCK(super_block);
+    int run, block, group, i, j;
+    int inode_num;
+    bool_t again;
+    vnode_t *vnode;
+
+    bzero((char *)report, sizeof(fsckInfo));
+    bzero((char *)fsck_blocks, sizeof(fsck_blocks));
+    bzero((char *)fsck_shares, sizeof(fsck_shares));
+    bzero((char *)fsck_used, sizeof(fsck_used));
+    bzero((char *)fsck_dirs, sizeof(fsck_dirs));
+    bzero((char *)fsck_refs, sizeof(fsck_refs));
+
+    // the super block has to describe the layout mkfs picks for its size
+    bcache_read(SUPER_BLOCK, fsck_buffer);
+    bzero((char *)&expected, sizeof(expected));
+    super_block_init(&expected, super_block->fs_size, super_block->features);
+    for (i = 0; i < sizeof(expected); i++) {
+        if (fsck_buffer[i] != ((char *)&expected)[i])
+            report->badSuper = 1;
+    }
+
+    // the inode table of each group, a run of blocks at a time
+    for (group = 0; group < super_block->group_count; group++) {
+        group_layout(&desc, group, super_block);
+        for (i = group * GROUP_BLOCKS; i < desc.data_start; i++) {
+            FSCK_SET(fsck_blocks, i);
+        }
+        for (block = 0; block * per_block < desc.inodes; block += run) {
+            run = (desc.inodes + per_block - 1) / per_block - block;
+            if (run > FSCK_RUN)
+                run = FSCK_RUN;
+            bcache_read_multi(desc.inode_table + block, run, fsck_buffer);
+            for (i = 0; i < run * per_block && block * per_block + i < desc.inodes; i++) {
+                inode_num = group * super_block->group_inodes + block * per_block + i;
+                // the disk may keep less than a whole inode, the rest reads as zero
+                bzero((char *)&inode, sizeof(inode_t));
+                bcopy((unsigned char *)&fsck_buffer[i * super_block->inode_size], (unsigned char *)&inode,
+                      super_block->inode_size);
+                if (inode.type == TYPE_FREE) { continue; }
+                FSCK_SET(fsck_used, inode_num);
+                if (inode.type == TYPE_DIRECTORY)
+                    FSCK_SET(fsck_dirs, inode_num);
+                fsck_links[inode_num] = (inode.links < 0xffff) ? inode.links : 0xffff;
+                report->inodes++;
+                fsck_inode(&inode, report, super_block);
+            }
+        }
+    }
+
+    // then the group descriptors, the allocation maps and the reference counts as they are on
+    // disk. the free counts of a group have to agree with its maps
+    alloc_map_load(super_block);
+    for (group = 0; group < super_block->group_count; group++) {
+        group_layout(&desc, group, super_block);
+        desc.free_blocks = ba_map.group_free[group];
+        desc.free_inodes = ino_map.group_free[group];
+        for (i = 0; i < sizeof(desc); i++) {
+            if (((char *)&desc)[i] != ((char *)&group_table.descs[group])[i]) {
+                report->badGroups++;
+                break;
+            }
+        }
+    }
+    for (i = 0; i < super_block->fs_size; i++) {
+        if (FSCK_TEST(fsck_blocks, i))
+            report->blocks++;
+        if (FSCK_TEST(fsck_blocks, i) && !map_test(&ba_map, i)) {
+            report->lostBlocks++;
+            if (repair)
+                map_set(&ba_map, i);
+        }
+        else if (!FSCK_TEST(fsck_blocks, i) && map_test(&ba_map, i)) {
+            report->leakedBlocks++;
+            if (repair)
+                map_clear(&ba_map, i);
+        }
+        if (fsck_shares[i] != ref_table.counts[i]) {
+            report->badRefs++;
+            if (repair)
+                ref_set(i, fsck_shares[i]);
+        }
+    }
+    for (i = 0; i < super_block->max_num_inodes; i++) {
+        if (FSCK_TEST(fsck_used, i) != map_test(&ino_map, ino_bit(i, super_block))) {
+            report->badInodeMap++;
+            if (repair && FSCK_TEST(fsck_used, i))
+                map_set(&ino_map, ino_bit(i, super_block));
+            else if (repair)
+                map_clear(&ino_map, ino_bit(i, super_block));
+        }
+    }
+    // a repaired group gets its layout back, the free counts follow the maps at the next flush
+    for (group = 0; repair && group < super_block->group_count; group++) {
+        group_layout(&group_table.descs[group], group, super_block);
+        group_table.dirty[group / GROUP_DESCS_PER_BLOCK] = TRUE;
+    }
+    // the repaired maps and reference counts can take up much of the cache, they go to the log
+    // on their own. the caller synced before, so the running transaction was empty
+    if (repair)
+        op_end(super_block);
+
+    // an inode no entry names is an orphan once no descriptor holds it, the root is named by no
+    // entry but is never one. freeing an orphaned directory drops the references its entries
+    // made, which can orphan what it held, so a repair goes on until no orphan is left
+    do {
+        again = FALSE;
+        for (i = 0; i < super_block->max_num_inodes; i++) {
+            if (!FSCK_TEST(fsck_used, i) || i == ROOT_DIRECTORY || fsck_refs[i] > 0) { continue; }
+            if (vnode_is_open(i)) { continue; }
+            report->orphans++;
+            if (!repair) { continue; }
+            if (FSCK_TEST(fsck_dirs, i)) {
+                fsck_drop_entries(i, super_block);
+                again = TRUE;
+            }
+            inode_free(i, super_block);
+            FSCK_CLEAR(fsck_used, i);
+            op_end(super_block);
+        }
+    } while (again);
+
+    // then compare the link counts with the entries found, the root keeps its one link.
+    // entries naming an inode that is not in use are bad
+    for (i = 0; i < super_block->max_num_inodes; i++) {
+        if (!FSCK_TEST(fsck_used, i)) {
+            report->badEntries += fsck_refs[i];
+            continue;
+        }
+        j = (i == ROOT_DIRECTORY) ? 1 : fsck_refs[i];
+        if (j != 0 && fsck_links[i] != j) {
+            report->badLinks++;
+            if (repair) {
+                vnode = vnode_get(i, super_block);
+                vnode->inode.links = j;
+                vnode_dirty(vnode);
+                vnode_put(vnode, super_block);
+                op_end(super_block);
+            }
+        }
+    }
+    for (i = 0; repair && report->badEntries > 0 && i < super_block->max_num_inodes; i++) {
+        if (FSCK_TEST(fsck_used, i) && FSCK_TEST(fsck_dirs, i))
+            fsck_remove_entries(i, super_block);
+    }
+
+    report->repaired = repair;
+}
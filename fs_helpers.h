@@ -9,33 +9,132 @@
 // super block stuff
 #define SUPER_BLOCK 0
 #define MAGIC_NUM 0xabcd
+#define FS_VERSION 14 // on-disk format revision, 14 = inode size chosen by mkfs
+#define FS_FEATURE_EXTENTS 0x1 // new regular files are mapped with extents instead of block pointers
+#define FS_FEATURE_JOURNAL 0x2 // metadata updates go through a write-ahead log
+#define FS_FEATURE_INLINE 0x4 // new files and directories start out with their contents in the inode, mkfs -i
+#define MAX_NUM_INODES 65520 // directory entries hold 16 bit inode numbers, block numbers are 32 bit
+#define FS_MAX_INODES ((FS_MAX_SIZE * 3 / 4) / 16 * 16 < MAX_NUM_INODES ? (FS_MAX_SIZE * 3 / 4) / 16 * 16 : MAX_NUM_INODES)
+#define FS_FEATURES (FS_FEATURE_EXTENTS | FS_FEATURE_JOURNAL) // features mkfs always turns on
 
 typedef struct {
     uint32_t magic_num;
     uint32_t fs_size; // size of file system in blocks
-    uint32_t inode_start; // first block where inodes are stored
-    uint32_t max_num_inodes; // maximum number of inodes that can be in file system. scales with FS_SIZE
-    uint32_t inode_count; // number of blocks allocated for inodes
-    uint32_t ba_map_start; // first block where block allocation map is stored
-    uint32_t ba_map_count; // number of blocks allocated for block allocation map
-    uint32_t data_start; // first block where data blocks are stored
-    uint32_t data_count; // number of blocks allocated for data
+    uint32_t max_num_inodes; // maximum number of inodes that can be in file system. scales with fs_size
+    uint32_t group_count; // number of allocation groups the blocks are split into
+    uint32_t group_inodes; // inodes in each group, the last group may have fewer
+    uint32_t group_table_start; // first block of the group descriptor table, right after the super block
+    uint32_t group_table_count; // number of blocks allocated for the group descriptor table
+    uint32_t version; // on-disk format revision this file system was made with
+    uint32_t features; // FS_FEATURE_* flags chosen by mkfs
+    uint32_t journal_start; // first block of the metadata log, between the reference counts and group 0
+    uint32_t journal_count; // number of blocks allocated for the log, 0 without FS_FEATURE_JOURNAL
+    uint32_t block_size; // bytes in a block, a build with a different BLOCK_SIZE does not mount it
+    uint32_t ref_table_start; // first block of the reference count table, after the group descriptors
+    uint32_t ref_table_count; // number of blocks allocated for the reference count table
+    uint32_t inode_size; // bytes each inode takes in the inode table, sizeof(inode_t) with FS_FEATURE_INLINE
 } super_block_t;
 
+// allocation map stuff, the block and the inode allocation maps both use one bit per object
+#define MAP_BITS_PER_BLOCK (BLOCK_SIZE * 8)
+#define MAP_MAX_BLOCKS (1 + (FS_MAX_SIZE - 1) / MAP_BITS_PER_BLOCK) // enough blocks to map FS_MAX_SIZE objects
+#define MAP_WORDS (MAP_MAX_BLOCKS * MAP_BITS_PER_BLOCK / 32)
+
+// allocation group stuff. the blocks are split into groups of as many blocks as one map block
+// tracks, and each group keeps its own block map, inode map, slice of the inode table and data
+// blocks in that order. group 0 has the super block, the group descriptors, the reference counts
+// and the log in front of its own. inode n is inode n % group_inodes of group n / group_inodes
+#define GROUP_BLOCKS MAP_BITS_PER_BLOCK // blocks in a group, the last group may have fewer
+#define GROUP_MAX MAP_MAX_BLOCKS // enough groups for FS_MAX_SIZE blocks
+#define GROUP_MIN_BLOCKS 16 // a last group shorter than this is left out of the file system
+
+typedef struct {
+    uint32_t block_map; // block holding the group's part of the block allocation map
+    uint32_t inode_map; // block holding the group's part of the inode allocation map
+    uint32_t inode_table; // first block of the group's slice of the inode table
+    uint32_t inodes; // number of inodes in the slice
+    uint32_t data_start; // first data block of the group
+    uint32_t data_count; // number of data blocks in the group
+    uint32_t free_blocks; // data blocks of the group not in use
+    uint32_t free_inodes; // inodes of the group not in use
+} group_desc_t; // 32 bytes, so there are 16 group descriptors per block
+
+#define GROUP_DESCS_PER_BLOCK (BLOCK_SIZE / sizeof(group_desc_t))
+#define GROUP_TABLE_MAX_BLOCKS (1 + (GROUP_MAX - 1) / GROUP_DESCS_PER_BLOCK)
+
+// reference count stuff, one byte per block counting the owners it has besides the first. only
+// clones share data blocks, so a block with a count of 0 belongs to one file as usual
+#define REF_MAX 255 // most extra owners a block can have, cloning a file holding such a block fails
+#define REF_MAX_BLOCKS (1 + (FS_MAX_SIZE - 1) / BLOCK_SIZE) // enough blocks to count FS_MAX_SIZE blocks
+
 // inode stuff
 #define TYPE_FREE 0
 #define TYPE_DIRECTORY 1
 #define TYPE_FILE 2
-#define DATA_BLOCK_NUM 8 // each file can have 4MB of data
+#define DATA_BLOCK_NUM 8 // number of direct block pointers in an inode
+#define PTRS_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t)) // block pointers held by an indirect block
+#define MAX_FILE_BLOCKS (DATA_BLOCK_NUM + PTRS_PER_BLOCK + PTRS_PER_BLOCK * PTRS_PER_BLOCK)
+#define MAX_FILE_BYTES ((int) (MAX_FILE_BLOCKS < 0x7fffffff / BLOCK_SIZE ? MAX_FILE_BLOCKS * BLOCK_SIZE : 0x7fffffff)) // file sizes are ints
+#define ALLOC_ROOM 8 // free blocks left after the new run of a growing file, so it can grow in place
+#define INODE_EXTENT_MAPPED 0x1 // inode flag, the file is a list of extents
+#define INODE_INLINE 0x4 // inode flag, the contents are kept in the inode instead of data blocks
+#define INODE_INLINE_SIZE 108 // bytes of contents an inode can hold, 3 directory entries
+
+// a run of length blocks on disk starting at start holding file blocks file_block onwards
+typedef struct {
+    uint32_t file_block;
+    uint32_t start;
+    uint32_t length;
+} extent_t;
+
+#define INODE_EXTENTS 3 // extents kept in the inode itself
+#define EXTENTS_PER_BLOCK (BLOCK_SIZE / sizeof(extent_t)) // extents kept in the overflow block
+#define MAX_EXTENTS (INODE_EXTENTS + EXTENTS_PER_BLOCK)
 
 typedef struct {
     uint32_t size; // size of the file in bytes
-    uint32_t fd_count; // number of open file descriptors for this file
     uint32_t links; // number of links to this file
-    uint16_t in_use_blocks; // number of in use data blocks for this file
-    uint16_t direct_blocks[DATA_BLOCK_NUM];
+    uint32_t in_use_blocks; // number of file blocks the mapping covers, holes included
     uint16_t type; // type of the file (directory, free inode, file)
-} inode_t; // total size of an inode is 32 bytes, so there are 16 inodes per block
+    uint16_t flags; // INODE_* flags
+    uint32_t allocated_blocks; // data blocks actually allocated, fewer than in_use_blocks if there are holes
+    union {
+        // block mapped files
+        struct {
+            uint32_t direct_blocks[DATA_BLOCK_NUM];
+            uint32_t indirect_block; // block of pointers to the data blocks after the direct ones, 0 if none
+            uint32_t double_indirect_block; // block of pointers to indirect blocks, 0 if none
+        };
+        // extent mapped files, extents are sorted by file_block
+        struct {
+            uint32_t num_extents; // number of extents in the inode and the overflow block
+            uint32_t extent_block; // block holding the extents past INODE_EXTENTS, 0 if none
+            extent_t extents[INODE_EXTENTS];
+        };
+        // inline files and directories, bytes past size are zero
+        char inline_data[INODE_INLINE_SIZE];
+    };
+} inode_t; // total size of an inode is 128 bytes, on disk only the first inode_size of them are kept
+
+#define INODE_BASE_SIZE 64 // bytes of an inode up to the end of its block mapping, all a disk without inline data keeps
+#define INODES_PER_BLOCK(sb) (BLOCK_SIZE / (sb)->inode_size)
+
+// in-core inode stuff
+#define VNODE_TABLE_SIZE (2 * MAX_OPEN_FILES + 64) // every open file pins its own and its directory's, plus room to cache
+#define VNODE_HASH_SIZE 128 // number of hash buckets, must be a power of 2
+
+typedef struct vnode {
+    inode_t inode; // in-core copy of the inode
+    int inode_num; // index of the inode on disk, -1 if this vnode is unused
+    int ref_count; // number of holders, a vnode is only evicted when this is 0
+    uint32_t open_count; // number of open file descriptors for this file
+    uint32_t dir_open_count; // number of open files that were opened in this directory
+    uint32_t map_gen; // bumped whenever block mappings of the inode are dropped
+    bool_t dirty; // TRUE if the in-core copy has not been written back
+    struct vnode *hash_next; // next vnode in the same hash bucket
+    struct vnode *lru_prev; // neighbours on the list of unreferenced vnodes
+    struct vnode *lru_next;
+} vnode_t;
 
 // directory stuff
 #define ROOT_DIRECTORY 0 // root directory is inode 0
@@ -44,43 +143,126 @@ typedef struct {
 typedef struct {
     uint16_t inode; // index of the file's inode
     char name[MAX_FILE_NAME_COPY]; // name of the file
-} directory_entry_t; // there can be 15 directory entries per block plus 2 bytes padding, so 120 files per directory
+} directory_entry_t; // there can be 15 directory entries per block plus 2 bytes padding
+
+// a linear directory keeps its entries in one block; once that is full the directory is indexed:
+// block 0 becomes a root mapping the low bits of a name hash to leaf blocks, which split as they fill
+#define INODE_DIR_INDEXED 0x2 // inode flag, the directory is a hashed index
+#define DIR_MAX_DEPTH 7 // the root maps at most 2^7 hash prefixes, fuller leaves chain overflow leaves
+#define DIR_LEAF_ENTRIES ((int) ((BLOCK_SIZE - 8) / sizeof(directory_entry_t))) // 14 entries per leaf at 512 byte blocks
+#define DIR_POSITION_SLOTS DIR_LEAF_ENTRIES // dir_next_entry position of an indexed directory is leaf * DIR_POSITION_SLOTS + slot
+
+typedef struct {
+    uint32_t num_entries; // entries in the whole directory
+    uint16_t depth; // number of hash bits used to pick a leaf
+    uint16_t pad;
+    uint16_t leaves[1 << DIR_MAX_DEPTH]; // file block of the leaf for each hash prefix
+} dir_root_t;
+
+typedef struct {
+    uint16_t depth; // number of hash bits all entries of this leaf share
+    uint16_t count; // number of entries in use
+    uint32_t next; // file block of the overflow leaf chained to this one, 0 if none
+    directory_entry_t entries[DIR_LEAF_ENTRIES];
+} dir_leaf_t;
+
+// name lookup cache stuff
+#define DCACHE_SIZE 128 // number of names the cache can hold
+#define DCACHE_HASH_SIZE 64 // number of hash buckets, must be a power of 2
 
 // file stuff
-#define MAX_FILE_DESCRIPTORS 256
+#define MAX_OPEN_FILES 256 // entries of the open file table shared by every process
+#define FD_MAP_RUNS 4 // contiguous block runs each file descriptor caches for sequential access
+#define RA_MIN_WINDOW 4 // blocks read ahead once a descriptor turns out to be sequential
+#define RA_MAX_WINDOW 16 // the read ahead window doubles on every refill up to this many blocks
 typedef struct {
     bool_t open; // tracks if this entry is open
     uint16_t permissions; // the r/w permissions of this file
-    uint16_t inode; // inode of file on disk
-    uint16_t directory; // directory of file on disk
+    vnode_t *vnode; // in-core inode of the file
+    vnode_t *dir_vnode; // in-core inode of the directory the file was opened in
+    int next_free; // next free entry of the open file table while this one is free
     uint32_t position; // current cursor position in bytes of file
+    uint32_t map_gen; // map_gen of the vnode when the mapping window was filled
+    int map_count; // number of runs in the window, 0 if it is empty
+    extent_t map_runs[FD_MAP_RUNS]; // mappings of consecutive file blocks
+    uint32_t ra_position; // where a read continuing the last one would start
+    uint32_t ra_end; // file block index past the last block read ahead
+    int ra_window; // blocks to read ahead on the next refill, 0 while access is random
 } file_t;
 
 // super block functions
-void super_block_init(super_block_t *sblock, int fs_size);
+void super_block_init(super_block_t *sblock, int fs_size, int features);
 super_block_t *super_block_read(char *block_buffer);
 void super_block_write(char *block_buffer);
 
+// allocation map functions
+void alloc_map_init(super_block_t *super_block);
+void alloc_map_load(super_block_t *super_block);
+void alloc_map_flush(super_block_t *super_block);
+bool_t block_is_data(int block, super_block_t *super_block);
+int inode_free_count(void);
+
 // data block functions
-int get_free_data(super_block_t *super_block);
+int get_free_data(int goal, super_block_t *super_block);
 void data_free(int data_block, super_block_t *super_block);
+int data_free_count(void);
+int data_private_run(int data_block, int count);
+int data_shared_count(void);
 
 // inode functions
 void inode_init(inode_t *inode, int type);
-int get_free_inode(super_block_t *super_block);
-inode_t *inode_read(char *block_buffer, int inode_num, super_block_t *super_block);
-void inode_write(char *block_buffer, int inode_num, super_block_t *super_block);
+int get_free_inode(int dir_inode_num, int type, super_block_t *super_block);
+int dir_goal(vnode_t *dir_vnode, super_block_t *super_block);
 void inode_free(int inode_num, super_block_t *super_block);
 
+// block map functions
+int inode_bmap(inode_t *inode, int index, super_block_t *super_block);
+int inode_runs(inode_t *inode, super_block_t *super_block);
+void inode_flush(inode_t *inode, super_block_t *super_block);
+int inode_alloc(inode_t *inode, int index, int count, int goal, super_block_t *super_block);
+int inode_grow(inode_t *inode, int count, super_block_t *super_block);
+void inode_truncate(inode_t *inode, int num_blocks, super_block_t *super_block);
+int inode_uninline(inode_t *inode, int goal, super_block_t *super_block);
+int inode_clone(inode_t *dest, inode_t *src, super_block_t *super_block);
+int inode_unshare(inode_t *inode, int index, super_block_t *super_block);
+
+// in-core inode functions
+void vnode_init(void);
+vnode_t *vnode_get(int inode_num, super_block_t *super_block);
+void vnode_put(vnode_t *vnode, super_block_t *super_block);
+void vnode_dirty(vnode_t *vnode);
+void vnode_write(vnode_t *vnode, super_block_t *super_block);
+void vnode_sync(super_block_t *super_block);
+void op_end(super_block_t *super_block);
+void vnode_fill_records(dirEnt *records, int n, super_block_t *super_block);
+
 // directory functions
 int dir_add(char *name, int dir_inode_num, int file_inode_num, super_block_t *super_block);
 int dir_remove(int dir_inode_num, char *name, super_block_t *super_block);
 int dir_find(int dir_inode_num, char *name, super_block_t *super_block);
+void dcache_init(void);
+void dcache_purge_dir(int dir);
+void dcache_get_stats(uint32_t *hits, uint32_t *misses);
+bool_t dir_is_empty(int dir_inode_num, super_block_t *super_block);
+int dir_next_entry(int dir_inode_num, int *position, directory_entry_t *entry, super_block_t *super_block);
+
+// open file table functions
+void file_table_init(void);
+file_t *file_open(vnode_t *vnode, int permissions, vnode_t *dir_vnode);
+void file_close(file_t *file);
 
 // file descriptor table functions
-int fd_open(file_t *fd_table, int inode, int permissions, int directory);
-void fd_close(file_t *fd_table, int fd_index);
-int fd_dir_search(file_t *fd_table, int directory);
+int fd_alloc(fdTable *fds, file_t *file);
+file_t *fd_lookup(fdTable *fds, int fd);
+void fd_free(fdTable *fds, int fd);
+int fd_first(fdTable *fds);
+int fd_bmap(file_t *file, int index, int *run, super_block_t *super_block);
+void fd_readahead(file_t *file, int position, int count, super_block_t *super_block);
+
+// consistency checker
+#define FSCK_RUN BCACHE_MAX_RUN // inode table blocks read with one transfer
+#define FSCK_NAMES 16 // bad entries gathered from a directory before they are removed
+void fsck_check(fsckInfo *report, bool_t repair, super_block_t *super_block);
 
 #endif
 
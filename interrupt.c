@@ -67,7 +67,11 @@ int system_call_helper(int fn, int arg1, int arg2, int arg3) {
 		distinguish between different argument numbers. Just pass all 3
 		arguments and it will work
 	*/
+	if (syscall_uses_fs[fn])
+		fs_lock_acquire();
 	ret_val	= syscall[fn] (arg1, arg2, arg3);
+	if (syscall_uses_fs[fn])
+		fs_lock_release();
 	
 	//	We can not leave the critical section we enter here before we return in syscall_entry.
 	//	This is due to a potential race condition on a scratch variable used by syscall_entry.
@@ -0,0 +1,324 @@
+/*
+ * Author(s): Changxiao Xie
+ * COS 318, Fall 2018: Project 6 File System.
+ * Write-ahead log of metadata blocks, committed in groups and replayed at mount.
+*/
+#include "util.h"
+#include "common.h"
+#include "block.h"
+#include "bcache.h"
+#include "fs.h"
+#include "journal.h"
+
+// block 0 of the log is a header saying which transaction replay starts with. each transaction
+// follows as a descriptor block, a revoke block if it freed blocks an earlier transaction logged,
+// a copy of every block it changed, and a commit block. the commit block carries a checksum of
+// the rest, so a transaction only counts once all of it has reached the disk
+#define JOURNAL_HEADER_MAGIC 0x4a484452
+#define JOURNAL_DESC_MAGIC 0x4a445343
+#define JOURNAL_COMMIT_MAGIC 0x4a434d54
+#define JOURNAL_DESC_BLOCKS ((BLOCK_SIZE / sizeof(uint32_t)) - 5) // home locations a descriptor holds
+#define JOURNAL_REVOKES (BLOCK_SIZE / sizeof(uint32_t)) // entries in a revoke block
+#define JOURNAL_MAX_TRANSACTION (BCACHE_SIZE + 3) // log blocks taken by the largest transaction
+
+typedef struct {
+    uint32_t magic;
+    uint32_t id; // changes at every mkfs so records left by an older file system never match
+    uint32_t seq; // sequence number of the first transaction in the log
+} journal_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t id;
+    uint32_t seq;
+    uint32_t count; // blocks logged by this transaction
+    uint32_t revokes; // entries in the revoke block, which is left out if there are none
+    uint32_t blocks[JOURNAL_DESC_BLOCKS]; // home location of each logged block
+} journal_desc_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t id;
+    uint32_t seq;
+    uint32_t checksum; // covers the descriptor, the revoke block and the logged blocks
+} journal_commit_t;
+
+static int log_start; // block holding the log header
+static int log_count; // blocks in the log region, 0 if metadata is not journaled
+static int log_head; // log block the next transaction is written at
+static uint32_t log_id;
+static uint32_t log_seq; // sequence number of the next transaction
+static int num_ops; // operations in the running transaction
+static uint32_t logged[(FS_MAX_SIZE + 31) / 32]; // blocks in the log since it was last emptied
+static uint32_t revoked[JOURNAL_REVOKES]; // logged blocks freed by the running transaction
+static int num_revoked;
+static uint32_t revoke_seq[JOURNAL_REVOKES]; // replay only, transaction that revoked each block
+static char log_buffer[JOURNAL_WRITE_RUN * BLOCK_SIZE]; // staging area for log writes
+static journal_stats_t stats;
+
+#define LOGGED(block) (logged[(block) / 32] & ((uint32_t) 1 << ((block) % 32)))
+
+static uint32_t checksum_block(uint32_t sum, char *block) {
+    uint32_t *words = (uint32_t *)block;
+    int i;
+    for (i = 0; i < BLOCK_SIZE / sizeof(uint32_t); i++) {
+        sum = ((sum << 5) | (sum >> 27)) ^ words[i];
+    }
+    return sum;
+}
+
+// LOG WRITING STUFF
+
+// write the header so replay starts at the next transaction, which makes the log empty
+static void header_write(void) {
+    journal_header_t *header = (journal_header_t *)log_buffer;
+
+    bzero_block(log_buffer);
+    header->magic = JOURNAL_HEADER_MAGIC;
+    header->id = log_id;
+    header->seq = log_seq;
+    block_write(log_start, log_buffer);
+    log_head = 1;
+    num_revoked = 0;
+    bzero((char *)logged, sizeof(logged));
+}
+
+// write the staged log blocks with one sequential transfer
+static void log_flush(int *staged) {
+    block_write_multi(log_start + log_head, *staged, log_buffer);
+    log_head += *staged;
+    stats.log_blocks += *staged;
+    stats.log_writes++;
+    *staged = 0;
+}
+
+// write every committed block home and empty the log; only done when nothing is uncommitted
+static void log_reset(void) {
+    bcache_flush();
+    if (log_head > 1) {
+        header_write();
+        stats.checkpoints++;
+    }
+}
+
+// LOG REPLAY STUFF
+
+// read the transaction seq at pos into log_buffer: the descriptor in slot 0, the revoke block in
+// slot 1 and the commit block in slot 2. return its length in blocks, or 0 if it is not complete
+static int transaction_read(int pos, uint32_t seq) {
+    journal_desc_t *desc = (journal_desc_t *)log_buffer;
+    journal_commit_t *commit = (journal_commit_t *)&log_buffer[2 * BLOCK_SIZE];
+    char *data = &log_buffer[3 * BLOCK_SIZE];
+    uint32_t sum;
+    int first;
+    int i;
+
+    if (pos + 2 > log_count) { return 0; }
+    block_read(log_start + pos, log_buffer);
+    if (desc->magic != JOURNAL_DESC_MAGIC || desc->id != log_id || desc->seq != seq) { return 0; }
+    if (desc->count > JOURNAL_DESC_BLOCKS || desc->revokes > JOURNAL_REVOKES) { return 0; }
+    first = pos + (desc->revokes > 0 ? 2 : 1);
+    if (first + desc->count + 1 > log_count) { return 0; }
+
+    sum = checksum_block(0, log_buffer);
+    if (desc->revokes > 0) {
+        block_read(log_start + pos + 1, &log_buffer[BLOCK_SIZE]);
+        sum = checksum_block(sum, &log_buffer[BLOCK_SIZE]);
+    }
+    for (i = 0; i < desc->count; i++) {
+        block_read(log_start + first + i, data);
+        sum = checksum_block(sum, data);
+    }
+    block_read(log_start + first + desc->count, (char *)commit);
+    if (commit->magic != JOURNAL_COMMIT_MAGIC || commit->id != log_id || commit->seq != seq) { return 0; }
+    if (commit->checksum != sum) { return 0; }
+    return first + desc->count + 1 - pos;
+}
+
+// TRUE if a transaction after seq freed block, so the copy logged by seq must not be replayed
+static bool_t revoked_after(uint32_t block, uint32_t seq) {
+    int i;
+    for (i = 0; i < num_revoked; i++) {
+        if (revoked[i] == block && revoke_seq[i] > seq)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// JOURNAL INTERFACE
+
+// lay out an empty log in count blocks at start and journal metadata from now on
+void journal_format(int start, int count) {
+    journal_header_t *header = (journal_header_t *)log_buffer;
+
+    log_start = start;
+    log_count = count;
+    num_ops = 0;
+    if (count == 0) {
+        bcache_set_journal(FALSE);
+        return;
+    }
+    // records of the file system this replaces may still be in the region, pick an id they cannot match
+    block_read(start, log_buffer);
+    log_id = (header->magic == JOURNAL_HEADER_MAGIC) ? header->id + 1 : 1;
+    log_seq = 1;
+    header_write();
+    bcache_set_journal(TRUE);
+}
+
+// replay the committed transactions of the log at start onto their home locations, then
+// start an empty log. the caller must drop any cached copies of the replayed blocks
+void journal_load(int start, int count) {
+    journal_header_t *header = (journal_header_t *)log_buffer;
+    journal_desc_t *desc = (journal_desc_t *)log_buffer;
+    char *data = &log_buffer[3 * BLOCK_SIZE];
+    uint32_t end_seq;
+    uint32_t seq;
+    int length;
+    int first;
+    int pos;
+    int i;
+
+    log_start = start;
+    log_count = count;
+    num_ops = 0;
+    if (count == 0) {
+        bcache_set_journal(FALSE);
+        return;
+    }
+    block_read(start, log_buffer);
+    if (header->magic != JOURNAL_HEADER_MAGIC) {
+        journal_format(start, count);
+        return;
+    }
+    log_id = header->id;
+    log_seq = header->seq;
+
+    // first find the complete transactions and collect what they revoked
+    num_revoked = 0;
+    pos = 1;
+    for (seq = log_seq; (length = transaction_read(pos, seq)) > 0; seq++) {
+        for (i = 0; i < desc->revokes && num_revoked < JOURNAL_REVOKES; i++) {
+            revoked[num_revoked] = ((uint32_t *)&log_buffer[BLOCK_SIZE])[i];
+            revoke_seq[num_revoked] = seq;
+            num_revoked++;
+        }
+        pos += length;
+    }
+    end_seq = seq;
+
+    // then copy their blocks home in order, so the newest copy of a block is written last
+    pos = 1;
+    for (seq = log_seq; seq < end_seq; seq++) {
+        block_read(log_start + pos, log_buffer);
+        first = pos + (desc->revokes > 0 ? 2 : 1);
+        for (i = 0; i < desc->count; i++) {
+            if (revoked_after(desc->blocks[i], seq)) { continue; }
+            block_read(log_start + first + i, data);
+            block_write(desc->blocks[i], data);
+        }
+        pos = first + desc->count + 1;
+        stats.replayed++;
+    }
+
+    log_seq = end_seq;
+    header_write();
+    bcache_set_journal(TRUE);
+}
+
+// an operation is done with its metadata, return TRUE if the running transaction should be committed.
+// pending counts blocks that still join the transaction before a commit. the cache cannot evict
+// uncommitted blocks, so it has to keep room for another operation
+bool_t journal_end_op(int pending) {
+    if (log_count == 0) { return FALSE; }
+    num_ops++;
+    return num_ops >= JOURNAL_GROUP_OPS || bcache_num_uncommitted() + pending >= JOURNAL_GROUP_BLOCKS;
+}
+
+// write the running transaction to the log with as few sequential transfers as possible. its
+// blocks may go home afterwards; they get there through the cache, and the log is only emptied
+// once it runs short of room for another transaction
+void journal_commit(void) {
+    int blocks[BCACHE_SIZE];
+    journal_desc_t *desc = (journal_desc_t *)log_buffer;
+    journal_commit_t *commit;
+    uint32_t sum;
+    int staged;
+    int n;
+    int i;
+
+    num_ops = 0;
+    if (log_count == 0) { return; }
+    n = bcache_uncommitted(blocks, BCACHE_SIZE);
+    if (n == 0 && num_revoked == 0) { return; }
+
+    bzero_block(log_buffer);
+    desc->magic = JOURNAL_DESC_MAGIC;
+    desc->id = log_id;
+    desc->seq = log_seq;
+    desc->count = n;
+    desc->revokes = num_revoked;
+    for (i = 0; i < n; i++) {
+        desc->blocks[i] = blocks[i];
+    }
+    sum = checksum_block(0, log_buffer);
+    staged = 1;
+    if (num_revoked > 0) {
+        bzero_block(&log_buffer[BLOCK_SIZE]);
+        bcopy((unsigned char *)revoked, (unsigned char *)&log_buffer[BLOCK_SIZE], num_revoked * sizeof(uint32_t));
+        sum = checksum_block(sum, &log_buffer[BLOCK_SIZE]);
+        staged++;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (staged == JOURNAL_WRITE_RUN)
+            log_flush(&staged);
+        bcache_peek(blocks[i], &log_buffer[staged * BLOCK_SIZE]);
+        sum = checksum_block(sum, &log_buffer[staged * BLOCK_SIZE]);
+        staged++;
+        logged[blocks[i] / 32] |= (uint32_t) 1 << (blocks[i] % 32);
+    }
+
+    if (staged == JOURNAL_WRITE_RUN)
+        log_flush(&staged);
+    commit = (journal_commit_t *)&log_buffer[staged * BLOCK_SIZE];
+    bzero_block((char *)commit);
+    commit->magic = JOURNAL_COMMIT_MAGIC;
+    commit->id = log_id;
+    commit->seq = log_seq;
+    commit->checksum = sum;
+    staged++;
+    log_flush(&staged);
+
+    bcache_committed();
+    log_seq++;
+    num_revoked = 0;
+    stats.commits++;
+
+    // everything is committed now, so this is the one point the log can be emptied
+    if (log_head + JOURNAL_MAX_TRANSACTION > log_count)
+        log_reset();
+}
+
+// commit the running transaction, write every block home and empty the log
+void journal_checkpoint(void) {
+    journal_commit();
+    if (log_count == 0) {
+        bcache_flush();
+        return;
+    }
+    log_reset();
+}
+
+// block was freed; if the log holds an older copy, replay must not write it over the block's next use
+void journal_forget(int block) {
+    if (log_count == 0 || !LOGGED(block)) { return; }
+    logged[block / 32] &= ~((uint32_t) 1 << (block % 32));
+    // every revoke clears a logged block and the log holds fewer than JOURNAL_REVOKES of them
+    ASSERT(num_revoked < JOURNAL_REVOKES);
+    revoked[num_revoked++] = block;
+}
+
+void journal_get_stats(journal_stats_t *stats_buf) {
+    bcopy((unsigned char *)&stats, (unsigned char *)stats_buf, sizeof(stats));
+}
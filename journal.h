@@ -0,0 +1,31 @@
+/*
+ * Author(s): Changxiao Xie
+ * COS 318, Fall 2018: Project 6 File System.
+ * Write-ahead log of metadata blocks, committed in groups and replayed at mount.
+*/
+#ifndef JOURNAL_INCLUDED
+#define JOURNAL_INCLUDED
+
+#define JOURNAL_BLOCKS 128 // size of the log region mkfs lays out, header included
+#define JOURNAL_GROUP_OPS 8 // operations batched into one transaction before it is committed
+#define JOURNAL_OP_BLOCKS 32 // most metadata blocks one operation may change, the cache keeps room for them
+#define JOURNAL_GROUP_BLOCKS (BCACHE_SIZE - JOURNAL_OP_BLOCKS) // commit sooner once the next operation might not fit
+#define JOURNAL_WRITE_RUN 8 // most log blocks written with one transfer
+
+typedef struct {
+    uint32_t commits; // transactions written to the log
+    uint32_t log_blocks; // blocks written to the log, descriptor and commit blocks included
+    uint32_t log_writes; // transfers used to write them
+    uint32_t checkpoints; // times the log was emptied after writing its blocks home
+    uint32_t replayed; // transactions replayed at mount
+} journal_stats_t;
+
+void journal_format(int start, int count);
+void journal_load(int start, int count);
+bool_t journal_end_op(int pending);
+void journal_commit(void);
+void journal_checkpoint(void);
+void journal_forget(int block);
+void journal_get_stats(journal_stats_t *stats);
+
+#endif
@@ -10,6 +10,7 @@
 #include "memory.h"
 #include "scheduler.h"
 #include "th.h"
+#include "thread.h"
 #include "util.h"
 #include "time.h"
 #include "fs.h"
@@ -20,6 +21,7 @@ static inline void	enable_paging(void);
 static void		create_gate(struct gate_t *entry, uint32_t offset, uint16_t selector, char type, char privilege);
 static void		create_segment(struct segment_t *entry, uint32_t base, uint32_t limit, char type, char privilege, char seg_type, uint8_t granularity);
 static void		init_syscall(int i, syscall_t call);
+static void		init_fs_syscall(int i, syscall_t call);
 static void		init_idt(void);
 static void		init_gdt(void);
 static void 	init_serial(void);
@@ -29,10 +31,16 @@ static int		create_thread(int i);
 static int		create_process(uint32_t location, uint32_t size);
 static pcb_t*	alloc_pcb();
 static void		insert_pcb(pcb_t *p);
+static int		pread(int fd, ioVec *iov, int offset);
+static int		pwrite(int fd, ioVec *iov, int offset);
 void 			write_serial(int character);
 
 //	System call table
 syscall_t	syscall[SYSCALL_COUNT];
+bool_t		syscall_uses_fs[SYSCALL_COUNT];
+
+//	Held while the file system serves a system call or the flusher writes it back
+static lock_t	fs_lock;
 
 //	Statically allocate some storage for the pcb's
 pcb_t		pcb[PCB_TABLE_SIZE];
@@ -54,6 +62,7 @@ static int			next_stack		= STACK_MIN;
 static unsigned int start_addr[NUM_THREADS] = {
 	(unsigned int) loader_thread,	//	Loads shell
 	(unsigned int) clock_thread,	//	Running indefinitely
+	(unsigned int) flusher_thread,	//	Writes the file system back periodically
 	(unsigned int) thread2,			//	Test thread
 	(unsigned int) thread3			//	Test thread
 };
@@ -90,21 +99,31 @@ void _start(void) {
 	init_syscall(SYSCALL_MBOX_RECV,   (syscall_t) mbox_recv);
 	init_syscall(SYSCALL_MBOX_SEND,   (syscall_t) mbox_send);
 	init_syscall(SYSCALL_GETCHAR,     (syscall_t) getchar);
-	init_syscall(SYSCALL_MKFS, (syscall_t) fs_mkfs);
-	init_syscall(SYSCALL_OPEN, (syscall_t) fs_open);
-	init_syscall(SYSCALL_CLOSE, (syscall_t) fs_close);
-	init_syscall(SYSCALL_READ, (syscall_t) fs_read);
-	init_syscall(SYSCALL_WRITE, (syscall_t) fs_write);
-	init_syscall(SYSCALL_LSEEK, (syscall_t) fs_lseek);
-	init_syscall(SYSCALL_MKDIR, (syscall_t) fs_mkdir);
-	init_syscall(SYSCALL_RMDIR, (syscall_t) fs_rmdir);
-	init_syscall(SYSCALL_CD, (syscall_t) fs_cd);
-	init_syscall(SYSCALL_LINK, (syscall_t) fs_link);
-	init_syscall(SYSCALL_UNLINK, (syscall_t) fs_unlink);
-	init_syscall(SYSCALL_STAT, (syscall_t) fs_stat);
+	init_fs_syscall(SYSCALL_FSCK, (syscall_t) fs_fsck);
+	init_fs_syscall(SYSCALL_MKFS, (syscall_t) fs_mkfs);
+	init_fs_syscall(SYSCALL_OPEN, (syscall_t) fs_open);
+	init_fs_syscall(SYSCALL_CLOSE, (syscall_t) fs_close);
+	init_fs_syscall(SYSCALL_READ, (syscall_t) fs_read);
+	init_fs_syscall(SYSCALL_WRITE, (syscall_t) fs_write);
+	init_fs_syscall(SYSCALL_LSEEK, (syscall_t) fs_lseek);
+	init_fs_syscall(SYSCALL_MKDIR, (syscall_t) fs_mkdir);
+	init_fs_syscall(SYSCALL_RMDIR, (syscall_t) fs_rmdir);
+	init_fs_syscall(SYSCALL_CD, (syscall_t) fs_cd);
+	init_fs_syscall(SYSCALL_LINK, (syscall_t) fs_link);
+	init_fs_syscall(SYSCALL_UNLINK, (syscall_t) fs_unlink);
+	init_fs_syscall(SYSCALL_STAT, (syscall_t) fs_stat);
 	init_syscall(SYSCALL_READDIR,     (syscall_t) readdir);
 	init_syscall(SYSCALL_LOADPROC,    (syscall_t) loadproc);
 	init_syscall(SYSCALL_WRITE_SERIAL,(syscall_t) write_serial); 
+	init_fs_syscall(SYSCALL_FSINFO, (syscall_t) fs_info);
+	init_fs_syscall(SYSCALL_PREAD,       (syscall_t) pread);
+	init_fs_syscall(SYSCALL_PWRITE,      (syscall_t) pwrite);
+	init_fs_syscall(SYSCALL_READV, (syscall_t) fs_readv);
+	init_fs_syscall(SYSCALL_WRITEV, (syscall_t) fs_writev);
+	init_fs_syscall(SYSCALL_SYNC, (syscall_t) fs_sync);
+	init_fs_syscall(SYSCALL_FSYNC, (syscall_t) fs_fsync);
+	init_fs_syscall(SYSCALL_GETDENTS, (syscall_t) fs_getdents);
+	init_fs_syscall(SYSCALL_CLONE, (syscall_t) fs_clone);
 
 	init_idt();
 	init_gdt();
@@ -118,6 +137,8 @@ void _start(void) {
 	time_init();
 	keyboard_init();
 	
+	lock_init(&fs_lock);
+
 	/* Create the threads. But do not start test threads:
 	 * thread2 and thread3 */ 
 	for (i = 0; i < NUM_THREADS - 2; i++) {
@@ -208,6 +229,21 @@ static void init_syscall(int i, syscall_t call) {
 	syscall[i] = call;
 }
 
+/* Same as init_syscall, for the system calls that go into the file
+ * system; system_call_helper runs them holding fs_lock. */
+static void init_fs_syscall(int i, syscall_t call) {
+	init_syscall(i, call);
+	syscall_uses_fs[i] = TRUE;
+}
+
+void fs_lock_acquire(void) {
+	lock_acquire(&fs_lock);
+}
+
+void fs_lock_release(void) {
+	lock_release(&fs_lock);
+}
+
 //	This function enables paging by setting CR0[31] to 1.
 static inline void enable_paging() {
 	__asm__ volatile("movl	%cr0,%eax		\n\t" 
@@ -544,6 +580,7 @@ static int create_thread(int i) {
 	p->ds					= KERNEL_DS;
 	p->inV86				= 0;
 	p->v86_if				= 0;
+	bzero((char *) p->fds.used, sizeof(p->fds.used));	//	No open files yet
 
 	p->swap_loc				= 0;
 	p->swap_size			= 0;
@@ -597,6 +634,7 @@ static int create_process(uint32_t location, uint32_t size) {
 	p->ds					= PROCESS_DS | 3;
 	p->inV86				= 0;
 	p->v86_if				= 0;
+	bzero((char *) p->fds.used, sizeof(p->fds.used));	//	No open files yet
 
 	p->swap_loc				= location;
 	p->swap_size			= size;
@@ -746,6 +784,18 @@ void	loadproc(int location, int size) {
 	create_process(location, size);
 }
 
+/* Positional reads and writes take four arguments, one more than
+ * a system call carries, so the library passes the buffer and its
+ * length in an ioVec.
+ */
+static int	pread(int fd, ioVec *iov, int offset) {
+	return fs_pread(fd, iov->base, iov->len, offset);
+}
+
+static int	pwrite(int fd, ioVec *iov, int offset) {
+	return fs_pwrite(fd, iov->base, iov->len, offset);
+}
+
 
 //	Reset timer 0 with the frequency specified by PREEMPT_TICKS.
 void	reset_timer(void) {
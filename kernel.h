@@ -55,7 +55,7 @@ enum {
 	/*	Number of threads initially started by the kernel. Change
 		this when adding to or removing elements from the start_addr array.
 	*/
-	NUM_THREADS						= 4,
+	NUM_THREADS						= 5,
 	
 	//	Number of pcbs the OS supports
 	PCB_TABLE_SIZE					= 128,
@@ -118,6 +118,7 @@ typedef struct pcb_t {
 					*previous;
 	uint32_t	inV86; // set when in virtual 86 mode.
 	uint32_t	v86_if; // true when interrupts are enabled.
+	fdTable		fds;	//	Open file descriptors, released at exit
 } pcb_t;
 
 /*	Structure describing the contents of an interrupt gate entry.
@@ -204,6 +205,11 @@ typedef	void	(*handler_t)(void);	//	Exception handlers don't return anythings
 */
 extern syscall_t syscall[SYSCALL_COUNT];
 
+/*	TRUE for the system calls served by the file system. These run one
+	at a time, holding the file system lock.
+*/
+extern bool_t syscall_uses_fs[SYSCALL_COUNT];
+
 //	An array of pcb structures we can allocate pcbs from
 extern pcb_t pcb[];
 
@@ -220,5 +226,8 @@ extern tss_t tss;
 	void	print_status(int time);
 	//	Reset timer 0 to the frequency specified by PREEMPT_TICKS
 	void	reset_timer(void);
+	//	Serialize the file system between system calls and the flusher thread
+	void	fs_lock_acquire(void);
+	void	fs_lock_release(void);
 	
 #endif
@@ -1,11 +1,11 @@
 #!/usr/bin/python
 
-import os, sys, subprocess
+import os, sys, subprocess, time
 fs_size_bytes = 1048576
 
 def spawn_lnxsh():
     global p
-    p = subprocess.Popen('./lnxsh', shell=True, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    p = subprocess.Popen('exec ./lnxsh', shell=True, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
 
 def issue(command):
     p.stdin.write(command + '\n')
@@ -21,6 +21,13 @@ def do_exit():
     issue('exit')
     return p.communicate()[0]
 
+# Kill the shell without letting it exit, as if the machine lost power
+def crash():
+    p.stdin.flush()
+    time.sleep(1)
+    p.kill()
+    p.wait()
+
 # Verify that mkfs zeroes out previous file system
 def mkfs_test():
     print('*****Make File System Test*****')
@@ -433,6 +440,536 @@ def other_test():
     print('***********************')
     sys.stdout.flush()
 
+# The file system should still be there when the shell is restarted
+def remount_test():
+    print('*****Remount Test*****')
+    issue('mkfs')
+    issue('mkdir dir')
+    issue('cd dir')
+    issue('create file 100')
+    print do_exit()
+
+    #no mkfs this time, fs_init should find the old file system
+    spawn_lnxsh()
+    issue('cd dir')
+    issue('ls')
+    issue('cat file')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# Files past the direct blocks go through the indirect and double indirect blocks
+def large_file_test():
+    print('*****Large File Test*****')
+    issue('mkfs')
+    issue('create big 600000')
+    issue('stat big')
+    issue('open big 1')
+    issue('lseek 0 599000')
+    issue('read 0 40')
+    issue('close 0')
+
+    #freeing the file has to give back every block, or the second one won't fit
+    issue('unlink big')
+    issue('create big2 600000')
+    issue('stat big2')
+    issue('unlink big2')
+    issue('ls')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# A file that can't grow in place picks up a second extent somewhere else
+def extent_test():
+    print('*****Extent Test*****')
+    issue('mkfs')
+    issue('create f1 2000')
+    issue('create f2 2000')
+    issue('create f3 2000')
+    issue('unlink f2')
+    #big fills the hole f2 left, then continues after f3
+    issue('create big 20000')
+    issue('stat big')
+    print do_exit()
+
+    #the extents have to survive a restart
+    spawn_lnxsh()
+    issue('open big 1')
+    issue('lseek 0 2040')
+    issue('read 0 20')
+    issue('lseek 0 19990')
+    issue('read 0 40')
+    issue('close 0')
+    issue('cat f3')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+def path_test():
+    print('*****Path Test*****')
+    issue('mkfs')
+    issue('mkdir a')
+    issue('mkdir a/b')
+    issue('create a/b/f 50')
+    issue('cat /a/b/f')
+    issue('stat a/b/f')
+    issue('stat a//b/')
+    issue('cd /a/b')
+    issue('ls')
+    issue('cd ../..')
+    issue('link a/b/f g')
+    issue('unlink /a/b/f')
+    issue('stat g')
+    #a file is not a directory to walk through
+    issue('stat g/x')
+    issue('rmdir a/b/..')
+    issue('rmdir a/b')
+    issue('ls')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+def readahead_test():
+    print('*****Readahead Test*****')
+    issue('mkfs')
+    issue('create f 3000')
+    print do_exit()
+
+    #a fresh cache: cat reads sequentially, the seeks after it do not
+    spawn_lnxsh()
+    issue('cat f')
+    issue('open f 1')
+    issue('lseek 0 2500')
+    issue('read 0 10')
+    issue('lseek 0 100')
+    issue('read 0 10')
+    issue('close 0')
+    issue('fsinfo')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+def vector_test():
+    print('*****Positional and Vector I/O Test*****')
+    issue('mkfs')
+    issue('open f 3')
+    issue('writev 0 abc defgh ij')
+    #pwrite past the end leaves a hole of zeros and does not move the position
+    issue('pwrite 0 20 XYZ')
+    issue('pread 0 1 6')
+    issue('write 0 KL')
+    issue('readv 0 2 3')
+    issue('lseek 0 0')
+    issue('readv 0 1 4 0 30')
+    issue('pread 0 100 4')
+    issue('pread 0 -1 4')
+    issue('stat f')
+    issue('close 0')
+    #a file open read only can not be written either way
+    issue('open f 1')
+    issue('pwrite 0 0 no')
+    issue('writev 0 no')
+    issue('close 0')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+def sparse_test():
+    print('*****Sparse File Test*****')
+    issue('mkfs')
+    issue('open f 3')
+    issue('write 0 abc')
+    #skipping past the end leaves holes, only the blocks written to are allocated
+    issue('lseek 0 3000')
+    issue('write 0 Z')
+    issue('pwrite 0 10000 tail')
+    issue('stat f')
+    #writing into a hole allocates just that block
+    issue('pwrite 0 1200 mid')
+    issue('stat f')
+    issue('close 0')
+    print do_exit()
+
+    #holes read back as zeros after a restart too
+    spawn_lnxsh()
+    issue('open f 1')
+    issue('pread 0 1195 12')
+    issue('pread 0 2995 10')
+    issue('pread 0 9995 12')
+    issue('close 0')
+    issue('unlink f')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+def quick_mkfs_test():
+    print('*****Quick Mkfs Test*****')
+    issue('mkfs')
+    issue('create old 3000')
+    #mkfs leaves the old data blocks alone, none of it may show up in new files
+    issue('mkfs')
+    issue('open f 3')
+    issue('lseek 0 700')
+    issue('write 0 x')
+    issue('pread 0 690 15')
+    issue('pwrite 0 1600 y')
+    issue('pread 0 1020 20')
+    issue('close 0')
+    issue('mkdir d')
+    issue('cd d')
+    issue('ls')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# The operations committed to the metadata log before a crash have to
+# come back at mount
+def journal_test():
+    print('*****Journal Test*****')
+    issue('mkfs')
+    issue('mkdir dir')
+    issue('cd dir')
+    for i in range(0, 12):
+        issue('create f' + str(i) + ' ' + str(50 * i))
+    issue('unlink f3')
+    issue('cd ..')
+    issue('mkdir empty')
+    issue('rmdir empty')
+    crash()
+
+    #no exit, so nothing was synced; the log is all there is
+    spawn_lnxsh()
+    issue('cd dir')
+    issue('ls')
+    issue('stat f11')
+    issue('cat f10')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# What fsync and sync made durable survives a kill, the rest is lost.
+# fsync writes the data blocks of its own file home
+def sync_test():
+    print('*****Sync Test*****')
+    issue('mkfs')
+    issue('open kept 3')
+    issue('write 0 durable')
+    issue('fsync 0')
+    issue('fsync 7')
+    issue('mkdir synced')
+    issue('sync')
+    issue('open lost 3')
+    issue('write 0 gone')
+    crash()
+
+    spawn_lnxsh()
+    issue('ls')
+    issue('cat kept')
+    print do_exit()
+
+    spawn_lnxsh()
+    issue('open blocks 3')
+    issue('pwrite 0 600 fsynced')
+    issue('fsync 0')
+    crash()
+
+    spawn_lnxsh()
+    issue('open blocks 1')
+    issue('pread 0 600 7')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# With mkfs -i small files and directories live in the inode until they outgrow it
+def inline_test():
+    print('*****Inline Test*****')
+    issue('mkfs -i')
+    issue('create tiny 30')
+    issue('stat tiny')
+    issue('open tiny 3')
+    issue('lseek 0 30')
+    issue('write 0 abcdefghijklmnopqrstuvwxyz0123456789')
+    issue('stat tiny')
+    issue('lseek 0 66')
+    issue('write 0 abcdefghijklmnopqrstuvwxyz0123456789ABCD')
+    issue('stat tiny')
+    issue('write 0 EFGHIJKLMN')
+    issue('stat tiny')
+    issue('pread 0 20 40')
+    issue('pread 0 90 30')
+    issue('close 0')
+    issue('mkdir d')
+    issue('stat d')
+    issue('create d/a 5')
+    issue('stat d')
+    issue('create d/b 5')
+    issue('stat d')
+    issue('cd d')
+    issue('ls')
+    issue('cd ..')
+    issue('unlink d/a')
+    issue('unlink d/b')
+    issue('rmdir d')
+    issue('create small 20')
+    print do_exit()
+
+    #after a restart reading the small file only reads its inode
+    spawn_lnxsh()
+    issue('cat small')
+    issue('fsinfo')
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# ls lists any directory by path, in batches, and refuses plain files
+def listing_test():
+    print('*****Listing Test*****')
+    issue('mkfs')
+    issue('mkdir d')
+    issue('cd d')
+    for i in range(0, 40):
+        issue('create f' + str(i) + ' ' + str(i))
+    issue('cd ..')
+    issue('ls d')
+    issue('ls d/f3')
+    issue('ls missing')
+    issue('cd d')
+    issue('ls ..')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# Descriptors come from the lowest free slot, and a directory cannot be
+# removed while a file opened in it is still open, even once it is unlinked
+def descriptor_test():
+    print('*****Descriptor Test*****')
+    issue('mkfs')
+    issue('mkdir d')
+    issue('open d/a 3')
+    issue('open d/b 3')
+    issue('close 0')
+    issue('open d/c 3')
+    issue('unlink d/a')
+    issue('unlink d/b')
+    issue('unlink d/c')
+    issue('rmdir d')
+    issue('close 0')
+    issue('rmdir d')
+    issue('close 1')
+    issue('rmdir d')
+    issue('close 1')
+    issue('ls')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# A file unlinked while it is open keeps its inode until it is closed;
+# after a crash fsck has to find it and give its blocks back
+def fsck_test():
+    print('*****Fsck Test*****')
+    issue('mkfs')
+    issue('mkdir d')
+    issue('cd d')
+    issue('create f 3000')
+    issue('link f g')
+    issue('create tmp 5000')
+    issue('open tmp 1')
+    issue('unlink tmp')
+    issue('fsck -r')
+    issue('read 0 10')
+    issue('sync')
+    crash()
+
+    spawn_lnxsh()
+    issue('fsck')
+    issue('fsck -r')
+    issue('fsck')
+    issue('stat d/f')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# A clone shares the data blocks of its source until one of them writes
+# to a block, and a shared block stays in use until the last file holding
+# it is gone; the reference counts have to survive a crash
+def clone_test():
+    print('*****Clone Test*****')
+    issue('mkfs')
+    issue('create f 3000')
+    issue('create s 20')
+    issue('clone f g')
+    issue('clone s t')
+    issue('open g 3')
+    issue('lseek 0 1000')
+    issue('write 0 CHANGED')
+    issue('close 0')
+    issue('open t 3')
+    issue('write 0 tt')
+    issue('close 0')
+    issue('sync')
+    crash()
+
+    spawn_lnxsh()
+    issue('clone missing x')
+    issue('clone f g')
+    issue('fsck')
+    issue('cat s')
+    issue('cat t')
+    issue('open f 1')
+    issue('pread 0 995 15')
+    issue('close 0')
+    issue('unlink f')
+    issue('fsck')
+    issue('open g 1')
+    issue('pread 0 995 15')
+    issue('close 0')
+    issue('stat g')
+    # the last clone finds every block at its most owners and must leave nothing behind
+    for i in range(0, 256):
+        issue('clone g h' + str(i))
+    issue('fsck')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# Files growing side by side in two directories: each file should be
+# extended in place rather than interleaved with the others
+def frag_test():
+    print('*****Frag Test*****')
+    issue('mkfs')
+    issue('mkdir a')
+    issue('mkdir b')
+    for d in ('a', 'b'):
+        for i in range(0, 3):
+            issue('create ' + d + '/f' + str(i) + ' 600')
+    for d in ('a', 'b'):
+        for i in range(0, 3):
+            issue('open ' + d + '/f' + str(i) + ' 3')
+    for r in range(0, 30):
+        for fd in range(0, 6):
+            issue('lseek ' + str(fd) + ' ' + str(600 + r * 40))
+            issue('write ' + str(fd) + ' ' + 'x' * 40)
+    for fd in range(0, 6):
+        issue('close ' + str(fd))
+    issue('frag a')
+    issue('frag b/f1')
+    issue('frag missing')
+    issue('fsck')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# Freed blocks are not zeroed: whatever takes them next has to start
+# from a clean block. Blocks freed by unlink and rmdir are reused by a
+# file and a directory, and the result has to survive a crash
+def free_test():
+    print('*****Free Test*****')
+    issue('mkfs')
+    issue('mkdir d')
+    for i in range(0, 20):
+        issue('create d/f' + str(i) + ' 0')
+    issue('create big 3000')
+    issue('sync')
+    for i in range(0, 20):
+        issue('unlink d/f' + str(i))
+    issue('rmdir d')
+    issue('unlink big')
+    issue('mkdir e')
+    for i in range(0, 20):
+        issue('create e/g' + str(i) + ' 0')
+    issue('open h 3')
+    issue('lseek 0 700')
+    issue('write 0 tail')
+    issue('close 0')
+    issue('sync')
+    crash()
+
+    spawn_lnxsh()
+    issue('fsck')
+    issue('stat h')
+    issue('open h 1')
+    issue('pread 0 700 4')
+    issue('close 0')
+    issue('ls e')
+
+    print do_exit()
+    print('***********************')
+    sys.stdout.flush()
+
+# mkfs takes the size of the file system, and the geometry it picked
+# has to be read back from the super block after a restart. a write
+# stops at the largest file size, 8458240 bytes with 512 byte blocks
+def geometry_test():
+    print('*****Geometry Test*****')
+    issue('mkfs 100')
+    issue('mkfs 512 1024')
+    issue('mkfs 512')
+    issue('create big 300000')
+    issue('stat big')
+    output = do_exit()
+
+    spawn_lnxsh()
+    issue('fsinfo')
+    issue('stat big')
+    issue('unlink big')
+    issue('fsinfo')
+    issue('mkfs')
+    issue('fsinfo')
+    issue('open edge 3')
+    issue('pwrite 0 8458239 ab')
+    issue('pwrite 0 8458240 ab')
+    issue('stat edge')
+
+    output += do_exit()
+    for line in output.split('\n'):
+        if 'Block' in line or 'Free' in line or 'Size' in line or 'failed' in line or 'writing' in line:
+            print line
+    print('***********************')
+    sys.stdout.flush()
+
+# A file system bigger than one group: new directories go to different
+# groups and the files made in a directory go to its group, which shows
+# in the inode numbers; the group descriptors have to survive a restart.
+# it runs after the size check since it grows the disk
+def groups_test():
+    print('*****Groups Test*****')
+    issue('mkfs 16384')
+    for d in ('a', 'b', 'c', 'd'):
+        issue('mkdir ' + d)
+    issue('create a/f 3000')
+    issue('mkdir a/sub')
+    issue('create b/g 3000')
+    issue('ls')
+    issue('ls a')
+    issue('ls b')
+    output = do_exit()
+
+    spawn_lnxsh()
+    issue('unlink a/f')
+    issue('rmdir a/sub')
+    issue('fsck')
+    output += do_exit()
+    for line in output.split('\n'):
+        if 'D ' in line or 'F ' in line or 'Bad' in line or 'Inodes' in line:
+            print line
+    print('***********************')
+    sys.stdout.flush()
+
 print "......Starting my tests\n\n"
 sys.stdout.flush()
 spawn_lnxsh()
@@ -457,6 +994,44 @@ spawn_lnxsh()
 stat_test()
 spawn_lnxsh()
 other_test()
+spawn_lnxsh()
+remount_test()
+spawn_lnxsh()
+large_file_test()
+spawn_lnxsh()
+extent_test()
+spawn_lnxsh()
+path_test()
+spawn_lnxsh()
+readahead_test()
+spawn_lnxsh()
+vector_test()
+spawn_lnxsh()
+sparse_test()
+spawn_lnxsh()
+quick_mkfs_test()
+spawn_lnxsh()
+journal_test()
+spawn_lnxsh()
+sync_test()
+spawn_lnxsh()
+inline_test()
+spawn_lnxsh()
+listing_test()
+spawn_lnxsh()
+descriptor_test()
+spawn_lnxsh()
+fsck_test()
+spawn_lnxsh()
+clone_test()
+spawn_lnxsh()
+frag_test()
+spawn_lnxsh()
+free_test()
+spawn_lnxsh()
+geometry_test()
 
 # Verify that file system hasn't grow too large
 check_fs_size()
+spawn_lnxsh()
+groups_test()
@@ -8,6 +8,7 @@
 #include "thread.h"
 #include "util.h"
 #include "time.h"
+#include "fs.h"
 
 static int	eflags = INIT_EFLAGS;	// contents of EFlags when a job is started for the first time
 
@@ -165,6 +166,10 @@ void dispatch(void) {
 	will not be scheduled in the future
 */
 void exit(void) {
+	//	Close the files the process left open before it goes away
+	fs_lock_acquire();
+	fs_close_all();
+	fs_lock_release();
 	enter_critical();
 	current_running->status = EXITED;
 	//	Removes job from ready queue, and dispatchs next job to run
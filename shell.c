@@ -16,6 +16,8 @@
 #include "syslib.h"
 #endif
 
+#define LS_BATCH 16 // directory entries ls fetches with one call
+
 char line[SIZEX+1];
 char *argv[SIZEX];
 int argc;
@@ -33,17 +35,28 @@ static void shell_open( void);
 static void shell_read( void);
 static void shell_write( void);
 static void shell_lseek( void);
+static void shell_pread( void);
+static void shell_pwrite( void);
+static void shell_readv( void);
+static void shell_writev( void);
 static void shell_close( void);
 static void shell_mkdir( void);
 static void shell_rmdir( void);
 static void shell_cd( void);
 static void shell_link( void);
+static void shell_clone( void);
 static void shell_unlink( void);
 static void shell_stat( void);
 
 static void shell_ls( void);
 static void shell_create( void);
 static void shell_cat( void);
+static void shell_cp( void);
+static void shell_fsinfo( void);
+static void shell_sync( void);
+static void shell_fsync( void);
+static void shell_fsck( void);
+static void shell_frag( void);
 
 static void shell_listproc ( void );
 static void shell_loadproc ( void );
@@ -74,7 +87,8 @@ int START(void)
 		EXEC_COMMAND( "exit",   1,  1, "", shell_exit());
 		EXEC_COMMAND( "fire",   1,  1, "", shell_fire());
 		EXEC_COMMAND( "clear",  1,  1, "", shell_clearscreen());
-		EXEC_COMMAND( "mkfs",   1,  1, "", shell_mkfs());
+		EXEC_COMMAND( "mkfs",   1,  4, " [-i] [<blocks> [<block size>]]",
+			      shell_mkfs());
 		EXEC_COMMAND( "open",   3,  3, " <filename> <flag>",
 			      shell_open());
 		EXEC_COMMAND( "read",   3,  3, " <fd> <size>",
@@ -83,17 +97,32 @@ int START(void)
 			      shell_write());
 		EXEC_COMMAND( "lseek",  3,  3, " <fd> <offset>",
 			      shell_lseek());
+		EXEC_COMMAND( "pread",  4,  4, " <fd> <offset> <size>",
+			      shell_pread());
+		EXEC_COMMAND( "pwrite", 4,  4, " <fd> <offset> <string>",
+			      shell_pwrite());
+		EXEC_COMMAND( "readv",  3,  6, " <fd> <size> ...",
+			      shell_readv());
+		EXEC_COMMAND( "writev", 3,  6, " <fd> <string> ...",
+			      shell_writev());
 		EXEC_COMMAND( "mkdir",  2,  2, " <dirname>", shell_mkdir());
 		EXEC_COMMAND( "rmdir",  2,  2, " <dirname>", shell_rmdir());
 		EXEC_COMMAND( "cd",     2,  2, " <dirname>", shell_cd());
 		EXEC_COMMAND( "close",  2,  2, " <fd>", shell_close());
 		EXEC_COMMAND( "link",   3,  3, " <src> <dest>", shell_link());
+		EXEC_COMMAND( "clone",  3,  3, " <src> <dest>", shell_clone());
 		EXEC_COMMAND( "unlink", 2,  2, " <name>", shell_unlink());
 		EXEC_COMMAND( "stat",   2,  2, " <name>", shell_stat());
-		EXEC_COMMAND( "ls",     1,  2, "", shell_ls());
+		EXEC_COMMAND( "ls",     1,  2, " [<dirname>]", shell_ls());
 		EXEC_COMMAND( "create", 3,  3, " <filename> <size>",
 			      shell_create());
 		EXEC_COMMAND( "cat",    2,  2, " <filename>", shell_cat());
+		EXEC_COMMAND( "cp",     3,  3, " <src> <dest>", shell_cp());
+		EXEC_COMMAND( "fsinfo", 1,  1, "", shell_fsinfo());
+		EXEC_COMMAND( "sync",   1,  1, "", shell_sync());
+		EXEC_COMMAND( "fsync",  2,  2, " <fd>", shell_fsync());
+		EXEC_COMMAND( "fsck",   1,  2, " [-r]", shell_fsck());
+		EXEC_COMMAND( "frag",   2,  2, " <name>", shell_frag());
 		EXEC_COMMAND( "list",   1,  1, "", shell_listproc());
 		EXEC_COMMAND( "load",   2,  2, "", shell_loadproc());
 		writeStr( argv[0]);
@@ -144,6 +173,8 @@ static void readLine( void) {
 static void shell_exit( void) {
     writeStr( "Goodbye\n"); 
 #ifdef FAKE
+    // write the buffer cache back so ./disk is up to date for the next run
+    fs_sync();
     exit(0);
 #else
     exit();
@@ -158,8 +189,14 @@ static void shell_clearscreen( void) {
     clearShellScreen();
 }
 
+/* -i gives every inode room for the contents of a tiny file */
 static void shell_mkfs( void) {
-    if (fs_mkfs() != 0)
+    int flags = (argc > 1 && same_string(argv[1], "-i")) ? MKFS_INLINE : 0;
+    int arg = (flags != 0) ? 2 : 1;
+    int num_blocks = (argc > arg) ? atoi(argv[arg]) : 0;
+    int block_size = (argc > arg + 1) ? atoi(argv[arg + 1]) : 0;
+
+    if (fs_mkfs(num_blocks, block_size, flags) != 0)
 	writeStr("mkfs failed\n");
 }
 
@@ -230,6 +267,76 @@ static void shell_lseek( void) {
 	writeStr("OK\n");
 }
 
+static void shell_pread( void) {
+    char data[SIZEX];
+    int i, n, count;
+
+    n = atoi( argv[3]);
+    if ( n > SIZEX) {
+	writeStr( "Requested size too big\n");
+	return;
+    }
+    if ( ( count = fs_pread(atoi(argv[1]), data, n, atoi(argv[2]))) == -1)
+	writeStr("Read failed\n");
+    else {
+	writeStr("Data read in : ");
+	for ( i = 0; i < count; i++)
+	    writeChar( data[i]);
+	writeChar( RETURN);
+    }
+}
+
+static void shell_pwrite( void) {
+    if ( fs_pwrite( atoi(argv[1]), argv[3], strlen(argv[3]), atoi(argv[2])) == -1)
+	writeStr("Error while writing file\n");
+    else
+	writeStr("Done\n");
+}
+
+/* each size gets its own buffer, printed with a | between them */
+static void shell_readv( void) {
+    char data[SIZEX];
+    ioVec iov[4];
+    int i, j, n, count;
+
+    n = 0;
+    for ( i = 0; i < argc - 2; i++) {
+	iov[i].base = &data[n];
+	iov[i].len = atoi( argv[i + 2]);
+	n += iov[i].len;
+    }
+    if ( n > SIZEX) {
+	writeStr( "Requested size too big\n");
+	return;
+    }
+    if ( ( count = fs_readv(atoi(argv[1]), iov, argc - 2)) == -1)
+	writeStr("Read failed\n");
+    else {
+	writeStr("Data read in : ");
+	for ( i = 0; i < argc - 2 && count > 0; i++) {
+	    if ( i > 0)
+		writeChar( '|');
+	    for ( j = 0; j < iov[i].len && count > 0; j++, count--)
+		writeChar( iov[i].base[j]);
+	}
+	writeChar( RETURN);
+    }
+}
+
+static void shell_writev( void) {
+    ioVec iov[4];
+    int i;
+
+    for ( i = 0; i < argc - 2; i++) {
+	iov[i].base = argv[i + 2];
+	iov[i].len = strlen( argv[i + 2]);
+    }
+    if ( fs_writev( atoi(argv[1]), iov, argc - 2) == -1)
+	writeStr("Error while writing file\n");
+    else
+	writeStr("Done\n");
+}
+
 static void shell_close( void) {
     if (fs_close(atoi(argv[1])) == -1)
 	writeStr("Problem with closing file\n");
@@ -258,9 +365,46 @@ static void shell_cd( void) {
 	writeStr("OK\n");
 }
 
+static void print_one( dirEnt *ent) {
+    char spaces[] = "                                 ";
+    writeStr(ent->name);
+    // print 32 - length(name) + 1 spaces
+    spaces[32 - strlen(ent->name) + 1] = '\0';
+    writeStr(spaces);
+
+    if (ent->type == DIRECTORY) {
+        writeStr("D    ");
+    }
+    else {
+        writeStr("F    ");
+    }
+    writeInt(ent->inodeNo);
+    writeStr("     ");
+    writeInt(ent->size);
+    writeStr("\n");
+}
+
 static void shell_ls( void) {
-    //should a system call print to the screen?
-    fs_ls();
+    dirEnt ents[LS_BATCH];
+    int fd, n, i;
+
+    if ((fd = fs_open((argc > 1) ? argv[1] : ".", FS_O_RDONLY)) == -1) {
+	writeStr("Problem with ls\n");
+	return;
+    }
+    // only directories can be listed
+    if ((n = fs_getdents(fd, ents, LS_BATCH)) == -1) {
+	writeStr("Problem with ls\n");
+	fs_close(fd);
+	return;
+    }
+    writeStr("Name                             Type Inode Size\n");
+    while (n > 0) {
+	for (i = 0; i < n; i++)
+	    print_one(&ents[i]);
+	n = fs_getdents(fd, ents, LS_BATCH);
+    }
+    fs_close(fd);
 }
 
 static void shell_link( void) {
@@ -268,6 +412,11 @@ static void shell_link( void) {
 	writeStr("Problem with link\n");
 }
 
+static void shell_clone( void) {
+    if (fs_clone(argv[1], argv[2]) == -1)
+	writeStr("Problem with clone\n");
+}
+
 static void shell_unlink( void) {
     if (fs_unlink(argv[1]) == -1)
 	writeStr("Problem with unlink\n");
@@ -315,6 +464,137 @@ static void shell_cat( void) {
     writeChar( RETURN);
 }
 
+/* copy a file in large chunks, so whole blocks move without being staged */
+static void shell_cp( void) {
+    static char buf[4096];
+    int src, dest, n;
+
+    if ( ( src = fs_open( argv[1], FS_O_RDONLY)) < 0) {
+	writeStr( "Copy failed\n");
+	return;
+    }
+    if ( ( dest = fs_open( argv[2], FS_O_WRONLY)) < 0) {
+	fs_close( src);
+	writeStr( "Copy failed\n");
+	return;
+    }
+
+    while ( ( n = fs_read( src, buf, sizeof( buf))) > 0) {
+	if ( fs_write( dest, buf, n) != n) {
+	    writeStr( "Error while writing file\n");
+	    break;
+	}
+    }
+    fs_close( src);
+    fs_close( dest);
+}
+
+static void shell_fsinfo( void) {
+    fsInfo info;
+
+    if (fs_info( &info) != 0) {
+	writeStr( "Fsinfo failed\n");
+	return;
+    }
+    writeStr( "    Cache hits       : "); writeInt( info.cacheHits); writeChar( RETURN);
+    writeStr( "    Cache misses     : "); writeInt( info.cacheMisses); writeChar( RETURN);
+    writeStr( "    Disk reads       : "); writeInt( info.diskReads); writeChar( RETURN);
+    writeStr( "    Disk writes      : "); writeInt( info.diskWrites); writeChar( RETURN);
+    writeStr( "    Name cache hits  : "); writeInt( info.nameHits); writeChar( RETURN);
+    writeStr( "    Name cache misses: "); writeInt( info.nameMisses); writeChar( RETURN);
+    writeStr( "    Readahead hits   : "); writeInt( info.raHits); writeChar( RETURN);
+    writeStr( "    Readahead wasted : "); writeInt( info.raWasted); writeChar( RETURN);
+    writeStr( "    Log commits      : "); writeInt( info.logCommits); writeChar( RETURN);
+    writeStr( "    Log blocks       : "); writeInt( info.logBlocks); writeChar( RETURN);
+    writeStr( "    Log checkpoints  : "); writeInt( info.logCheckpoints); writeChar( RETURN);
+    writeStr( "    Block size       : "); writeInt( info.blockSize); writeChar( RETURN);
+    writeStr( "    Blocks           : "); writeInt( info.numBlocks); writeChar( RETURN);
+    writeStr( "    Free blocks      : "); writeInt( info.freeBlocks); writeChar( RETURN);
+    writeStr( "    Shared blocks    : "); writeInt( info.sharedBlocks); writeChar( RETURN);
+    writeStr( "    Groups           : "); writeInt( info.numGroups); writeChar( RETURN);
+    writeStr( "    Free inodes      : "); writeInt( info.freeInodes); writeChar( RETURN);
+}
+
+static void shell_sync( void) {
+    if (fs_sync() == -1)
+	writeStr("Problem with sync\n");
+    else
+	writeStr("OK\n");
+}
+
+static void shell_fsync( void) {
+    if (fs_fsync(atoi(argv[1])) == -1)
+	writeStr("Problem with fsync\n");
+    else
+	writeStr("OK\n");
+}
+
+static void shell_fsck( void) {
+    fsckInfo info;
+    int repair = (argc > 1 && same_string(argv[1], "-r"));
+
+    if (fs_fsck( &info, repair) != 0) {
+	writeStr( "Fsck failed\n");
+	return;
+    }
+    writeStr( "    Inodes in use    : "); writeInt( info.inodes); writeChar( RETURN);
+    writeStr( "    Blocks in use    : "); writeInt( info.blocks); writeChar( RETURN);
+    writeStr( "    Bad super block  : "); writeInt( info.badSuper); writeChar( RETURN);
+    writeStr( "    Leaked blocks    : "); writeInt( info.leakedBlocks); writeChar( RETURN);
+    writeStr( "    Lost blocks      : "); writeInt( info.lostBlocks); writeChar( RETURN);
+    writeStr( "    Bad blocks       : "); writeInt( info.badBlocks); writeChar( RETURN);
+    writeStr( "    Bad ref counts   : "); writeInt( info.badRefs); writeChar( RETURN);
+    writeStr( "    Bad groups       : "); writeInt( info.badGroups); writeChar( RETURN);
+    writeStr( "    Bad inode map    : "); writeInt( info.badInodeMap); writeChar( RETURN);
+    writeStr( "    Orphans          : "); writeInt( info.orphans); writeChar( RETURN);
+    writeStr( "    Bad link counts  : "); writeInt( info.badLinks); writeChar( RETURN);
+    writeStr( "    Bad entries      : "); writeInt( info.badEntries); writeChar( RETURN);
+    if (info.repaired)
+	writeStr( "Repaired\n");
+}
+
+/* count the runs of consecutive blocks a file is stored in, or all the files of a directory */
+static void shell_frag( void) {
+    static char path[MAX_PATH_NAME + MAX_FILE_NAME + 2];
+    dirEnt ents[LS_BATCH];
+    fileStat status;
+    int files = 0, blocks = 0, extents = 0;
+    int fd, n, i, len;
+
+    if ( fs_stat( argv[1], &status) == -1) {
+	writeStr( "Frag failed\n");
+	return;
+    }
+    if ( status.type == FILE_TYPE) {
+	files = 1;
+	blocks = status.numBlocks;
+	extents = status.numExtents;
+    }
+    else if ( strlen( argv[1]) <= MAX_PATH_NAME && ( fd = fs_open( argv[1], FS_O_RDONLY)) >= 0) {
+	/* the entries are named relative to the directory */
+	len = strlen( argv[1]);
+	bcopy( ( unsigned char *)argv[1], ( unsigned char *)path, len);
+	path[len++] = '/';
+	while ( ( n = fs_getdents( fd, ents, LS_BATCH)) > 0) {
+	    for ( i = 0; i < n; i++) {
+		if ( ents[i].type != FILE_TYPE)
+		    continue;
+		bcopy( ( unsigned char *)ents[i].name, ( unsigned char *)&path[len], MAX_FILE_NAME);
+		path[len + MAX_FILE_NAME] = '\0';
+		if ( fs_stat( path, &status) == 0) {
+		    files++;
+		    blocks += status.numBlocks;
+		    extents += status.numExtents;
+		}
+	    }
+	}
+	fs_close( fd);
+    }
+    writeStr( "    Files            : "); writeInt( files); writeChar( RETURN);
+    writeStr( "    Blocks           : "); writeInt( blocks); writeChar( RETURN);
+    writeStr( "    Extents          : "); writeInt( extents); writeChar( RETURN);
+}
+
 static void shell_listproc ( void ) {
 #ifdef FAKE
   writeStr ( "Not supported in fake mode.\n" );
@@ -73,8 +73,12 @@ int getchar(int *c) {
     return invoke_syscall(SYSCALL_GETCHAR, (int)c, IGNORE, IGNORE);
 }
 
-int fs_mkfs( void) {
-    return invoke_syscall( SYSCALL_MKFS, IGNORE, IGNORE, IGNORE); 
+int fs_fsck( fsckInfo *buf, int repair) {
+    return invoke_syscall( SYSCALL_FSCK, ( int)buf, repair, IGNORE); 
+}
+
+int fs_mkfs( int numBlocks, int blockSize, int flags) {
+    return invoke_syscall( SYSCALL_MKFS, numBlocks, blockSize, flags); 
 }
 
 int fs_open( char *filename, int flags) {
@@ -97,6 +101,32 @@ int fs_lseek( int fd, int offset) {
     return invoke_syscall( SYSCALL_LSEEK, fd, offset, IGNORE); 
 }
 
+/* a system call takes three arguments, so buf and count travel
+ * to the kernel together as a single buffer */
+int fs_pread( int fd, char *buf, int count, int offset) {
+    ioVec iov;
+
+    iov.base = buf;
+    iov.len = count;
+    return invoke_syscall( SYSCALL_PREAD, fd, ( int)&iov, offset); 
+}
+
+int fs_pwrite( int fd, char *buf, int count, int offset) {
+    ioVec iov;
+
+    iov.base = buf;
+    iov.len = count;
+    return invoke_syscall( SYSCALL_PWRITE, fd, ( int)&iov, offset); 
+}
+
+int fs_readv( int fd, ioVec *iov, int iovcnt) {
+    return invoke_syscall( SYSCALL_READV, fd, ( int)iov, iovcnt); 
+}
+
+int fs_writev( int fd, ioVec *iov, int iovcnt) {
+    return invoke_syscall( SYSCALL_WRITEV, fd, ( int)iov, iovcnt); 
+}
+
 int fs_mkdir( char *fileName) {
     return invoke_syscall( SYSCALL_MKDIR, ( int)fileName, IGNORE, IGNORE); 
 }
@@ -113,6 +143,10 @@ int fs_link( char *pathName, char *fileName) {
     return invoke_syscall( SYSCALL_LINK, ( int)pathName, (int)fileName, IGNORE); 
 }
 
+int fs_clone( char *pathName, char *fileName) {
+    return invoke_syscall( SYSCALL_CLONE, ( int)pathName, (int)fileName, IGNORE); 
+}
+
 int fs_unlink( char *fileName) {
     return invoke_syscall( SYSCALL_UNLINK, ( int)fileName, IGNORE, IGNORE); 
 }
@@ -121,6 +155,22 @@ int fs_stat( char *fileName, fileStat *buf) {
     return invoke_syscall( SYSCALL_STAT, ( int)fileName, ( int)buf, IGNORE); 
 }
 
+int fs_sync( void) {
+    return invoke_syscall( SYSCALL_SYNC, IGNORE, IGNORE, IGNORE); 
+}
+
+int fs_fsync( int fd) {
+    return invoke_syscall( SYSCALL_FSYNC, fd, IGNORE, IGNORE); 
+}
+
+int fs_info( fsInfo *buf) {
+    return invoke_syscall( SYSCALL_FSINFO, ( int)buf, IGNORE, IGNORE); 
+}
+
+int fs_getdents( int fd, dirEnt *buf, int count) {
+    return invoke_syscall( SYSCALL_GETDENTS, fd, ( int)buf, count); 
+}
+
 void readdir (unsigned char *buf) {
     invoke_syscall (SYSCALL_READDIR, (int)buf, IGNORE, IGNORE);
 }
@@ -29,17 +29,27 @@ enum {
 	void	loadproc(int location, int size);
         void	write_serial(int character);
 
-int fs_mkfs( void);
+int fs_fsck( fsckInfo *buf, int repair);
+int fs_mkfs( int numBlocks, int blockSize, int flags);
 int fs_open( char *filename, int flags);
 int fs_close( int fd);
 int fs_read( int fd, char *buf, int count);
 int fs_write( int fd, char *buf, int count);
 int fs_lseek( int fd, int offset);
+int fs_pread( int fd, char *buf, int count, int offset);
+int fs_pwrite( int fd, char *buf, int count, int offset);
+int fs_readv( int fd, ioVec *iov, int iovcnt);
+int fs_writev( int fd, ioVec *iov, int iovcnt);
 int fs_mkdir( char *fileName);
 int fs_rmdir( char *fileName);
 int fs_cd( char *pathName);
 int fs_link( char *pathName, char *fileName);
+int fs_clone( char *pathName, char *fileName);
 int fs_unlink( char *fileName);
 int fs_stat( char *fileName, fileStat *buf);
+int fs_sync( void);
+int fs_fsync( int fd);
+int fs_info( fsInfo *buf);
+int fs_getdents( int fd, dirEnt *buf, int count);
 
 #endif
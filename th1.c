@@ -2,6 +2,7 @@
 
 	loader_thread is used to load the shell. 
 	clock_thread  is a thread which runs indefinitely
+	flusher_thread writes the file system back every few seconds
 	Best viewed with tabs set to 4 spaces.
 */
 #include "kernel.h"
@@ -9,8 +10,11 @@
 #include "th.h"
 #include "mbox.h"
 #include "util.h"
+#include "sleep.h"
+#include "fs.h"
 
 #define MHZ 2392 /* CPU clock rate */
+#define FLUSH_INTERVAL 5000 /* milliseconds between background write backs */
 
 /*	This thread is started to load the user shell, which is 
 	the first process in the directory.
@@ -49,3 +53,16 @@ void clock_thread(void) {
 		yield();
 	}
 }
+
+/*	This thread wakes up periodically and writes back the dirty
+	inodes and cached blocks, in block order, so processes do not
+	wait for the write back inside their own file system calls.
+*/
+void flusher_thread(void) {
+	while(1) {
+		msleep(FLUSH_INTERVAL);
+		fs_lock_acquire();
+		fs_sync();
+		fs_lock_release();
+	}
+}